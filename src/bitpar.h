@@ -0,0 +1,136 @@
+/**
+ * Author: Ktrim contributors
+ * Date: Oct 2026
+ * Bit-parallel adapter matcher on 2-bit encoded reads ('--bitpar')
+ * This program is part of the Ktrim package
+**/
+
+/*
+ * update in v1.7: by default, an adapter is only checked at the seeds, i.e., the exact hits of the
+ * adapter index (see seed_scan.h), so a sequencing error in the first 3 bases of the adapter makes
+ * Ktrim miss it; with '--bitpar', the adapter is checked at every offset of the read instead
+ *
+ * each read is encoded into 3 bit-planes of 1 bit per base: bit 1 and bit 2 of the ASCII code (which
+ * differ among A, C, G and T) and a mask of the other bases (e.g., N, which never match); then the
+ * mismatches at an offset are the OR of the XORs between the 64-bit windows of the planes and the
+ * planes of the adapter, i.e., a few word operations per offset whatever the number of seeds
+ *
+ * the mismatches allowed are the same as the seed engine (kp.max_mismatch), but overlaps shorter than
+ * BITPAR_FUZZY_LEN still need an exact index hit, as a few random bases would easily match the
+ * adapter with 1 mismatch; i.e., the results only differ from the seed engine for longer overlaps
+*/
+const unsigned int BITPAR_FUZZY_LEN = 8;
+const uint64_t BITPAR_INDEX_MASK = ((uint64_t)1 << ADAPTER_INDEX_SIZE) - 1;
+
+// encode m (<= 64) bases into the bit-planes; the bits beyond m are 0
+void inline bitpar_encode64( const char *p, unsigned int m, uint64_t &lo, uint64_t &hi, uint64_t &n ) {
+#ifdef SIMD_USE_SSE
+	if( m == 64 ) {
+		const __m128i A = _mm_set1_epi8('A'), C = _mm_set1_epi8('C'), G = _mm_set1_epi8('G'), T = _mm_set1_epi8('T');
+		lo = hi = n = 0;
+		for( register unsigned int i=0; i!=64; i+=16 ) {
+			register __m128i v = _mm_loadu_si128( (const __m128i *)(p+i) );
+			register __m128i acgt = _mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8(v, A), _mm_cmpeq_epi8(v, C) ),
+												  _mm_or_si128( _mm_cmpeq_epi8(v, G), _mm_cmpeq_epi8(v, T) ) );
+			// bit 1 (or 2) of each byte is moved to bit 7, which stays in the same byte
+			lo |= (uint64_t)(uint16_t) _mm_movemask_epi8( _mm_slli_epi16(v, 6) ) << i;
+			hi |= (uint64_t)(uint16_t) _mm_movemask_epi8( _mm_slli_epi16(v, 5) ) << i;
+			n  |= (uint64_t)(uint16_t) ~_mm_movemask_epi8( acgt ) << i;
+		}
+		return;
+	}
+#endif
+	lo = hi = n = 0;
+	for( register unsigned int i=0; i!=m; ++i ) {
+		register char c = p[i];
+		lo |= (uint64_t)((c >> 1) & 1) << i;
+		hi |= (uint64_t)((c >> 2) & 1) << i;
+		if( c!='A' && c!='C' && c!='G' && c!='T' )
+			n |= (uint64_t)1 << i;
+	}
+}
+
+// encode a read; there is 1 more word than needed, so the windows never read beyond the planes
+void bitpar_encode( BITPAR_READ *br, const char *seq, unsigned int size ) {
+	register unsigned int nword = (size >> 6) + 2;
+	if( nword > br->capacity ) {
+		delete [] br->lo;
+		br->lo = new uint64_t[ nword * 3 ];
+		br->hi = br->lo + nword;
+		br->n  = br->hi + nword;
+		br->capacity = nword;
+	}
+
+	register unsigned int i, w;
+	for( i=0, w=0; i<size; i+=64, ++w )
+		bitpar_encode64( seq+i, (size-i < 64) ? size-i : 64, br->lo[w], br->hi[w], br->n[w] );
+	for( ; w!=nword; ++w )
+		br->lo[w] = br->hi[w] = br->n[w] = 0;
+}
+
+// the 64 bits of a plane from bit pos on
+uint64_t inline bitpar_window( const uint64_t *p, unsigned int pos ) {
+	register unsigned int w = pos >> 6, b = pos & 63;
+	return b ? (p[w] >> b) | (p[w+1] << (64-b)) : p[w];
+}
+
+// the mismatches (as bits) between the read from pos on and the adapter
+uint64_t inline bitpar_mismatch( const BITPAR_READ *br, const uint64_t *adapter, unsigned int pos, uint64_t valid ) {
+	return ( (bitpar_window(br->lo, pos) ^ adapter[0]) | (bitpar_window(br->hi, pos) ^ adapter[1]) |
+			 bitpar_window(br->n, pos) | adapter[2] ) & valid;
+}
+
+/*
+ * look for the adapter in both reads of a pair; br should have 2 elements
+ * returns the position of the adapter, or -1 if there is none
+*/
+int bitpar_find_adapter_pe( const CPEREAD *read, BITPAR_READ *br, const ktrim_param &kp ) {
+	bitpar_encode( br,   read->seq1, read->size );
+	bitpar_encode( br+1, read->seq2, read->size );
+
+	register unsigned int pos, len, max_mismatch_dynamic;
+	register uint64_t valid, mis1, mis2;
+	for( pos=0; pos+ADAPTER_INDEX_SIZE <= read->size; ++pos ) {
+		len = read->size - pos;
+		if( len > kp.adapter_len )
+			len = kp.adapter_len;
+		valid = ( len == 64 ) ? ~(uint64_t)0 : ((uint64_t)1 << len) - 1;
+		max_mismatch_dynamic = kp.max_mismatch[len];
+
+		mis1 = bitpar_mismatch( br, kp.adapter_bits1, pos, valid );
+		if( (unsigned int)__builtin_popcountll( mis1 ) > max_mismatch_dynamic )
+			continue;
+		mis2 = bitpar_mismatch( br+1, kp.adapter_bits2, pos, valid );
+		if( (unsigned int)__builtin_popcountll( mis2 ) > max_mismatch_dynamic )
+			continue;
+		if( len < BITPAR_FUZZY_LEN && (mis1 & BITPAR_INDEX_MASK) && (mis2 & BITPAR_INDEX_MASK) )
+			continue;
+
+		return pos;
+	}
+	return -1;
+}
+
+// for single-end reads, the index hit could also be the 2nd index (i.e., index3 at pos+OFFSET_INDEX3)
+int bitpar_find_adapter_se( const CSEREAD *read, BITPAR_READ *br, const ktrim_param &kp ) {
+	bitpar_encode( br, read->seq, read->size );
+
+	register unsigned int pos, len;
+	register uint64_t valid, mis;
+	for( pos=0; pos+ADAPTER_INDEX_SIZE <= read->size; ++pos ) {
+		len = read->size - pos;
+		if( len > kp.adapter_len )
+			len = kp.adapter_len;
+		valid = ( len == 64 ) ? ~(uint64_t)0 : ((uint64_t)1 << len) - 1;
+
+		mis = bitpar_mismatch( br, kp.adapter_bits1, pos, valid );
+		if( (unsigned int)__builtin_popcountll( mis ) > kp.max_mismatch[len] )
+			continue;
+		if( len < BITPAR_FUZZY_LEN && (mis & BITPAR_INDEX_MASK) &&
+			( len < OFFSET_INDEX3 + ADAPTER_INDEX_SIZE || ((mis >> OFFSET_INDEX3) & BITPAR_INDEX_MASK) ) )
+			continue;
+
+		return pos;
+	}
+	return -1;
+}
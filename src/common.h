@@ -27,10 +27,20 @@
 #include <string>
 #include <vector>
 #include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <getopt.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <zlib.h>
 using namespace std;
 
-const char * VERSION = "1.6.0 (Oct 2024)";
+const char * VERSION = "1.7.0 (Oct 2026)";
 
+// 1.7.0, faster input/output (block and mmap readers, parallel Gzip, writer threads, pipeline);
+//        SIMD adapter and quality kernels with runtime dispatch; add '--bitpar' and '--indel';
+//        add '--samples', '--server' and '--max-memory'; support reads of any length
 // 1.6.0, add '-w' option to output reads with adapters only;
 //        add built-in adapters for CLIP-seq;
 //        fix a bug in single-thread file-writing
@@ -45,21 +55,21 @@ const char * VERSION = "1.6.0 (Oct 2024)";
 // 1.2.1 fixed the bug in multi-file handling
 
 // structure of a READ
+// update in v1.7: reads of any length are supported (see fill_read in util.h); these sizes are only
+// used to estimate the memory when the record size of the input is unknown
 const unsigned int MAX_READ_ID    = 128;
 const unsigned int MAX_READ_CYCLE = 512;
 
 // maxmimum insert size to call a dimer
 const unsigned int DIMER_INSERT   = 1;
 
-// time interval for querying for writing
-static int write_thread;
-//const static chrono::milliseconds waiting_time_for_writing(1);
-const static chrono::microseconds waiting_time_for_writing(100);
-
+// update in v1.7: reads are NOT null-terminated any more, and trimming only changes the size
+// id keeps its tailing '\n' (included in id_len), while seq/qual do not
 typedef struct {
 	char *id;
 	char *seq;
 	char *qual;
+	unsigned int id_len;
 	unsigned int size;
 } CSEREAD;
 
@@ -67,14 +77,140 @@ typedef struct {
 	char *id1;
 	char *seq1;
 	char *qual1;
+	unsigned int id1_len;
 	unsigned int size;
 
 	char *id2;
 	char *seq2;
 	char *qual2;
+	unsigned int id2_len;
 	unsigned int size2;
 } CPEREAD;
 
+// update in v1.7: the copied reads of a batch are packed one after another (id, seq and qual) in an
+// arena, and the reads (CSEREAD/CPEREAD) point into it; the arena grows if needed (see util.h)
+typedef struct {
+	char *data;
+	size_t size, capacity;
+} READ_ARENA;
+
+// update in v1.7: bit-planes of a read for '--bitpar' (see bitpar.h); lo, hi and n share 1 allocation
+typedef struct {
+	uint64_t *lo, *hi, *n;
+	unsigned int capacity;		// words of each plane
+} BITPAR_READ;
+
+// a job for parallel decompression: the complete gzip members in [start, end) of the file,
+// or the deflate data between 2 checkpoints of a single-member file
+enum { GZJOB_PENDING, GZJOB_RUNNING, GZJOB_DONE, GZJOB_FAILED, GZJOB_SEQUENTIAL };
+typedef struct {
+	size_t start, end;
+	long point;		// the checkpoint to start from; -1 if the job starts with a member header
+	char *out;
+	size_t out_size, out_capacity;
+	int status;
+} GZ_JOB;
+
+// checkpoint in a single-member Gzip file, from which the inflation could be resumed (see zran.c
+// in zlib); it is followed by the window (i.e., the last 32 KB of output) in the index file
+typedef struct {
+	uint64_t out, in;		// offset in the uncompressed/compressed data
+	uint32_t bits;			// number of bits in data[in-1] that belong to the deflate block
+	uint32_t window_size;
+} GZ_POINT;
+
+typedef struct {
+	char magic[8];
+	uint64_t file_size, file_mtime;
+	uint64_t npoint;
+} GZ_INDEX_HEADER;
+
+// parallel decompression of a (mapped) BGZF or multi-member Gzip file
+typedef struct {
+	const unsigned char *data;
+	size_t size;
+
+	// jobs are dispatched and consumed in order; job k uses jobs[k % njob]
+	GZ_JOB *jobs;
+	unsigned int njob;
+	unsigned long next_dispatch, next_work, next_consume;
+	size_t scan_pos;	// where the next job starts
+	bool scan_paused;	// no more jobs until the current large member is inflated
+
+	// members that cannot be split are inflated by the reader thread
+	bool sequential;
+	size_t seq_pos;
+	z_stream zs;
+
+	GZ_JOB *current;	// the job whose output is being consumed
+	size_t out_offset;
+
+	// checkpoint index for single-member files (update in v1.7)
+	char *index_file;	// NULL if the index is not used
+	int index_fd;		// the windows are loaded from this file; -1 if there is no valid index
+	FILE *index_out;	// the index is being built in the sequential mode
+	uint64_t file_mtime;
+	GZ_POINT *points;
+	unsigned int npoint, point_capacity;
+	unsigned int next_point;	// the next checkpoint to dispatch
+
+	unsigned int nthread;
+	thread *workers;
+	mutex lock;
+	condition_variable job_ready, job_done;
+	bool quit;
+} PGZ_READER;
+
+// update in v1.7: read-ahead of plain-text files by an I/O helper thread, see fq_reader_prefetch
+typedef struct {
+	char *block;		// the next block of the file
+	long size;			// bytes in block, 0 for EOF and -1 for error
+	size_t used;		// bytes of block that have been taken by the reader
+	bool ready;			// block is filled and not used up
+	bool quit;
+	thread helper;
+	mutex lock;
+	condition_variable cond;
+} FQ_PREFETCH;
+
+// block-based FASTQ reader
+// FQ_MMAP: buffer is the whole file mapped by mmap
+// FQ_GZIP/FQ_PGZIP: Gzipped file decompressed by 1 or multiple threads
+enum { FQ_PLAIN, FQ_MMAP, FQ_GZIP, FQ_PGZIP };
+typedef struct {
+	int type;
+	int fd;
+	gzFile gfp;
+	PGZ_READER *pgz;
+	char *buffer;
+	size_t capacity;
+	size_t start, end;	// un-parsed data is buffer[start, end)
+	bool eof;			// no more data in the file
+	bool error;			// the file could not be read (e.g., a truncated Gzip file), eof is also set
+	FQ_PREFETCH *pf;	// NULL if there is no I/O helper thread
+	bool readahead;		// give readahead hints to the kernel for Gzipped files
+	size_t hinted;		// the file has been hinted up to this offset
+} FQ_READER;
+
+// update in v1.7: the files of a list are opened one ahead, see fq_list_next
+typedef struct {
+	const vector<string> *files;
+	unsigned int next;		// the next file to return
+	FQ_READER *ahead;		// the next file, opened in advance; NULL if it could not be opened
+	bool use_mmap, gz_index, prefetch;
+	unsigned int nthread;
+} FQ_LIST;
+
+// a record located in the FQ_READER buffer; NOT null-terminated
+typedef struct {
+	char *id;
+	char *seq;
+	char *qual;
+	unsigned int id_len;	// including the tailing '\n'
+	unsigned int seq_len;
+	unsigned int qual_len;
+} FQ_RECORD;
+
 typedef struct {
 	unsigned int *dropped;
 	unsigned int *real_adapter;
@@ -88,6 +224,28 @@ typedef struct {
 	char ** buffer2;
 	unsigned int *b1stored;
 	unsigned int *b2stored;
+	unsigned int *b1capacity;	// update in v1.7: the buffers grow if needed
+	unsigned int *b2capacity;
+
+	// update in v1.7: scatter-gather output pointing to the loaded reads, see emit_fastq_iovec
+	struct iovec ** iov1;
+	struct iovec ** iov2;
+	unsigned int *iov1n, *iov2n;
+	unsigned int *iov1capacity, *iov2capacity;
+
+	// update in v1.7: Gzipped output, see gz_writer.h
+	char ** gzbuffer1;
+	char ** gzbuffer2;
+	unsigned int *gz1stored;
+	unsigned int *gz2stored;
+	unsigned int *gz1capacity;
+	unsigned int *gz2capacity;
+	unsigned int ** mark1;	// start of each gzip member in buffer1
+	unsigned int ** mark2;
+	unsigned int *nmark;
+	z_stream *zs;
+	bool bgzf;
+	uint64_t coffset[2], uoffset[2];	// compressed/uncompressed bytes written, for the .gzi index
 } writeBuffer;
 
 // built-in adapters
@@ -141,28 +299,83 @@ const char * bgi_index1 = "AAG";		// use first 3 as index
 const char * bgi_index2 = "AAG";		// use first 3 as index
 const char * bgi_index3 = "TCG";		// for single-end data
 
-// seed and error configurations
-const unsigned int impossible_seed = 1000000;
-const unsigned int MAX_READ_LENGTH = 1024;
-const unsigned int MAX_SEED_NUM    = 128;
-
 //configurations for parallelization, which is highly related to memory usage
 //but seems to have very minor effect on running time
 const int READS_PER_BATCH            = 1 << 15;	// process 128 K reads per batch (for parallelization)
 const int BUFFER_SIZE_PER_BATCH_READ = 1 << 25;	// 128 MB buffer for each thread to store FASTQ
-const int MEM_SE_READSET = READS_PER_BATCH * (MAX_READ_ID+MAX_READ_CYCLE+MAX_READ_CYCLE);
-const int MEM_PE_READSET = READS_PER_BATCH * (MAX_READ_ID+MAX_READ_CYCLE+MAX_READ_CYCLE) * 2;
+const int READ_SLOT_SIZE = MAX_READ_ID + MAX_READ_CYCLE + MAX_READ_CYCLE;	// space for copying 1 read (estimated)
+const unsigned int BATCHES_IN_FLIGHT = 3;	// No. of batches being loaded, trimmed or waiting in multi-thread mode
+// update in v1.7: the batches are trimmed in pieces, which are taken by the working threads dynamically;
+// READS_PER_PIECE must be a multiple of GZ_MEMBER_READS
+const int READS_PER_PIECE = 1 << 12;
+const int BUFFER_SIZE_PER_PIECE = BUFFER_SIZE_PER_BATCH_READ / (READS_PER_BATCH / READS_PER_PIECE);	// grows if needed
 
 // enlarge the buffer for single-thread run
 //const int READS_PER_BATCH_ST = READS_PER_BATCH << 1;	// process 256 K reads per batch (for parallelization)
 //const int BUFFER_SIZE_PER_BATCH_READ_ST = BUFFER_SIZE_PER_BATCH_READ << 1;	// 256 MB buffer for each thread to store FASTQ
 const int READS_PER_BATCH_ST            = 1 << 15;	// No. of reads per-batch for single-thread
 const int BUFFER_SIZE_PER_BATCH_READ_ST = 1 << 25;	// buffer for single-thread to store FASTQ
-const int MEM_SE_READSET_ST = READS_PER_BATCH_ST * (MAX_READ_ID+MAX_READ_CYCLE+MAX_READ_CYCLE);
-const int MEM_PE_READSET_ST = READS_PER_BATCH_ST * (MAX_READ_ID+MAX_READ_CYCLE+MAX_READ_CYCLE) * 2;
+
+// update in v1.7: the batches and buffers are sized at runtime from the record size of the input and
+// '--max-memory' (see tune_memory in util.h); the above sizes are the defaults and upper limits
+const unsigned int TUNE_SAMPLE_READS = 1 << 12;	// No. of reads in the first input file to estimate the record size
+const unsigned int MIN_BATCHES_IN_FLIGHT = 2;
+
+// Gzipped output
+const int GZ_MEMBER_READS = 1 << 10;	// No. of input reads per gzip member
+const int GZ_MAX_MEMBERS  = (READS_PER_BATCH>READS_PER_BATCH_ST ? READS_PER_BATCH : READS_PER_BATCH_ST) / GZ_MEMBER_READS + 1;
+const int GZ_OUTPUT_LEVEL = 4;
+const unsigned int BGZF_BLOCK_DATA  = 0xff00;	// max. uncompressed bytes in a BGZF block (the same as bgzip)
+const unsigned int BGZF_HEADER_SIZE = 18;
+const unsigned char BGZF_HEADER[] = { 0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0, 0, 0 };
+const unsigned char BGZF_EOF[] = { 0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0, 0x1b, 0,
+									3, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+// size of each read() in the block-based FASTQ reader
+const unsigned int FQ_BLOCK_SIZE = 1 << 22;	// 4 MB
+const unsigned int FQ_READAHEAD_SIZE = FQ_BLOCK_SIZE << 2;	// for the readahead hints
+
+// parallel parsing of memory-mapped plain-text FASTQ files
+const size_t FQ_SEGMENT_SIZE = 1 << 26;				// 64 MB per segment for indexing
+const unsigned int FQ_CHECKPOINT_RECORDS = 1 << 10;
+
+// server mode
+const unsigned int SERVER_BACKLOG     = 16;			// jobs waiting for the server
+const unsigned int SERVER_MAX_REQUEST = 1 << 20;	// max. size of the options of a job
+
+// parallel decompression of Gzipped files
+const unsigned int PGZ_JOB_SIZE    = 1 << 20;	// compressed bytes per decompression job
+const unsigned int PGZ_MAX_MEMBER  = 1 << 22;	// larger members are inflated by the reader thread
+const unsigned int PGZ_JOBS_PER_THREAD = 2;
+const unsigned int GZ_WINDOW_SIZE  = 32768;
+const unsigned int GZ_INDEX_SPAN   = 1 << 22;	// uncompressed bytes between 2 checkpoints
+const char GZ_INDEX_SUFFIX[] = ".ktidx";
+const char GZ_INDEX_MAGIC[8] = { 'K', 'T', 'G', 'Z', 'I', 'D', 'X', '1' };
+const unsigned int GZIP_MIN_MEMBER = 18;		// header (10) + empty deflate stream (2) + trailer (8) - 2
 
 const char FILE_SEPARATOR = ',';
 
+// update in v1.7: a segment of a memory-mapped FASTQ file, see fq_split.h
+typedef struct {
+	size_t start, end;			// the records in [start, end) of the file
+	unsigned long first;		// index of the first record of the segment in the file
+	unsigned long nrecord;
+	vector<size_t> checkpoint;	// offset of every FQ_CHECKPOINT_RECORDS records in the segment
+} FQ_SEGMENT;
+
+typedef struct {
+	FQ_READER *fr;				// FQ_MMAP
+	vector<FQ_SEGMENT> segments;
+	unsigned long nrecord;
+} FQ_SPLIT;
+
+// the records [first, first+num) of input file fileCnt
+typedef struct {
+	unsigned int fileCnt;
+	unsigned long first;
+	unsigned int num;
+} FQ_RANGE;
+
 // paramaters related
 typedef struct {
 	char *filelist;
@@ -170,6 +383,24 @@ typedef struct {
 	char *outpre;
 	vector<string> R1s, R2s;
 
+	// update in v1.7: multi-sample mode, see sample_handler.h
+	char *samplelist;
+	vector<string> outpres;				// output prefix of each sample
+	vector<unsigned int> file_sample;	// sample of each input file in R1s/R2s
+
+	// update in v1.7: server mode, see server.h
+	char *server_socket;	// run as a server on this socket
+	char *connect_socket;	// send the job to the server on this socket
+
+	// update in v1.7: sizes of the batches and buffers, see tune_memory in util.h
+	unsigned long max_memory;		// in bytes; 0 for no limit
+	unsigned int reads_per_batch;	// for 2 or more threads
+	unsigned int reads_per_batch_st;	// for 1 thread
+	unsigned int batches_in_flight;	// for 3 or more threads
+	unsigned int piece_buffer_size;	// output buffer of a piece (and of a batch for 1 thread)
+	unsigned int batch_buffer_size_st;
+	unsigned int record_size;		// estimated size of a record (see tune_memory); 0 if unknown
+
 	unsigned int thread;
 	unsigned int min_length;
 	unsigned int phred;
@@ -184,35 +415,140 @@ typedef struct {
 
 	bool use_default_mismatch;
 	float mismatch_rate;
+	// update in v1.7: the maximum mismatches allowed for each compared length, and the adapters padded
+	// with '\0' to MAX_ADAPTER_SIZE for the vector compares (see init_mismatch in util.h)
+	unsigned char max_mismatch[ MAX_ADAPTER_SIZE+1 ];
+	char adapter_pad1[ MAX_ADAPTER_SIZE ], adapter_pad2[ MAX_ADAPTER_SIZE ];
+	// update in v1.7: check the adapters at every offset instead of the seeds, see bitpar.h
+	bool use_bitpar;
+	uint64_t adapter_bits1[3], adapter_bits2[3];
+	// update in v1.7: also allow indels in the adapters, see myers.h
+	bool use_indel;
+	uint64_t adapter_peq1[4], adapter_peq2[4];
+	// update in v1.7: the instruction set of the kernels, see simd.h
+	int simd_level;
 
 	bool paired_end_data;
 	bool write2stdout;
 	bool outputReadWithAdaptorOnly;
+	bool use_mmap;
+	bool gz_index;
+	bool gzip_output;
+	bool bgzf_output;
+	bool write_gzi;
+	bool use_writev;
 	FILE *fout1;
 	FILE *fout2;
+	FILE *fgzi1;
+	FILE *fgzi2;
 	FILE *flog;
 } ktrim_param;
 
-const char * param_list = "1:2:U:o:t:k:s:p:q:w:a:b:m:f:chRv";
+// update in v1.7: ordered output queue, see fq_writer.h
+typedef struct {
+	writeBuffer *wb;
+	const ktrim_param *kp;
+	unsigned int nslot;			// piece seq is stored in slot (seq % nslot) of wb
+	unsigned long *ready;		// ready[k] is (seq+1) if piece seq in slot k is ready for writing
+	unsigned long next_seq;		// the next sequence number to be assigned (by the main thread)
+	unsigned long written[2];	// No. of pieces written to read1 (or stdout) and read2
+	unsigned int nfile;
+	// multi-sample mode: kp is an array of the samples, and the pieces from sample_seq[i] on
+	// belong to sample sample_id[i] (sample 0 if there is none)
+	vector<unsigned long> sample_seq;
+	vector<unsigned int> sample_id;
+
+	thread *writers;
+	mutex lock;
+	condition_variable slot_ready, slot_free;
+	bool quit;
+	bool error;		// a write failed; the rest of the pieces are discarded (see oq_writer)
+} OUT_QUEUE;
+
+// update in v1.7: a batch of reads in the pipeline, see pipeline.h
+typedef struct {
+	void *reads;	// CSEREAD or CPEREAD array
+	READ_ARENA arena[2];		// the copied reads of read1 and read2
+	unsigned int loaded[2];		// No. of reads loaded by each reader (read1 and read2 for paired-end data)
+	unsigned int nloader;		// No. of readers that have loaded this batch
+	unsigned int sample;		// the sample of the reads (multi-sample mode)
+	unsigned long seq;			// piece p of this batch is piece (seq+p) of the output queue
+	unsigned int npiece, next_piece, piece_done;
+} READ_BATCH;
+
+// batch n uses batches[n % nbatch]
+typedef struct {
+	READ_BATCH *batches;
+	unsigned int nbatch;
+	unsigned int batch_size;		// max. No. of reads in a batch
+	unsigned int nreader;
+	unsigned long nready;			// batches [0, nready) have been loaded
+	unsigned long next_dispatch;	// the batch whose pieces are being dispatched to the working threads
+	unsigned long nreleased;		// batches [0, nreleased) have been trimmed
+	unsigned long released_seq;		// the output pieces of these batches are [0, released_seq)
+	unsigned int *line;				// No. of reads loaded for each sample
+	const unsigned int *file_sample;	// sample of each input file; NULL for a single sample
+	unsigned int last_sample;
+	bool input_done;
+	int error;
+
+	// update in v1.7: in split mode (see fq_split.h), there is no reader thread, and batch n (i.e., the
+	// reads in ranges[n]) could be loaded by any working thread once its buffer is released
+	bool split;
+	FQ_SPLIT *split1, *split2;		// one for each input file; split2 is NULL for single-end data
+	vector<FQ_RANGE> ranges;
+	unsigned long next_load;
+
+	// the files of the readers stopped by an error, which may still be referred by the batches;
+	// they are closed by pipe_free when the working threads are done
+	vector<FQ_READER *> orphans;
+
+	mutex lock;
+	condition_variable batch_ready, batch_free;
+} READ_PIPE;
+
+const char * param_list = "1:2:U:o:t:k:s:p:q:w:a:b:m:f:chRzv";
+// options without a short form (update in v1.7)
+enum { OPT_MMAP = 256, OPT_GZ_INDEX, OPT_BGZF, OPT_GZI, OPT_WRITEV, OPT_SAMPLES, OPT_SERVER, OPT_CONNECT, OPT_MAX_MEMORY, OPT_BITPAR, OPT_INDEL, OPT_SIMD };
+const struct option long_param_list[] = {
+	{ "mmap", no_argument, NULL, OPT_MMAP },
+	{ "gz-index", no_argument, NULL, OPT_GZ_INDEX },
+	{ "bgzf", no_argument, NULL, OPT_BGZF },
+	{ "gzi", no_argument, NULL, OPT_GZI },
+	{ "writev", no_argument, NULL, OPT_WRITEV },
+	{ "samples", required_argument, NULL, OPT_SAMPLES },
+	{ "server", required_argument, NULL, OPT_SERVER },
+	{ "connect", required_argument, NULL, OPT_CONNECT },
+	{ "max-memory", required_argument, NULL, OPT_MAX_MEMORY },
+	{ "bitpar", no_argument, NULL, OPT_BITPAR },
+	{ "indel", no_argument, NULL, OPT_INDEL },
+	{ "simd", required_argument, NULL, OPT_SIMD },
+	{ NULL, 0, NULL, 0 }
+};
 
 // definition of functions
 void usage();
 void init_param( ktrim_param &kp );
 int  process_cmd_param( int argc, char * argv[], ktrim_param &kp );
+int  open_output_files( ktrim_param &kp );
+void close_files( const ktrim_param &kp );
 void print_param( const ktrim_param &kp );
 void extractFileNames( const char *str, vector<string> & Rs );
-void loadFQFileNames( ktrim_param &kp );
+int  loadFQFileNames( ktrim_param &kp );
+int  loadSampleList( ktrim_param &kp );
+bool parse_memory_size( const char *str, unsigned long &size );
+void tune_memory( ktrim_param &kp );
+int  trim_files( const ktrim_param &kp );
 
 // C-style
-unsigned int load_batch_data_PE_C( FILE * fq1, FILE * fq2, CPEREAD *loadingReads, unsigned int num );
-bool check_mismatch_dynamic_PE_C( const CPEREAD *read, unsigned int pos, const ktrim_param &kp );
+unsigned int load_batch_data_PE_C( FQ_READER *fr, CPEREAD *loadingReads, READ_ARENA *arena, const unsigned int num, const bool isRead1 );
 int process_single_thread_PE_C( const ktrim_param &kp );
-int process_multi_thread_PE_C(  const ktrim_param &kp );
+int process_two_thread_PE_C( const ktrim_param &kp );
+int process_multi_thread_PE_C(  const ktrim_param &kp, const ktrim_param *samples, unsigned int nsample );
 
-unsigned int load_batch_data_SE_C( FILE * fp, CSEREAD *loadingReads, unsigned int num );
-bool check_mismatch_dynamic_SE_C( const char * p, unsigned int pos, const ktrim_param &kp );
+unsigned int load_batch_data_SE_C( FQ_READER *fr, CSEREAD *loadingReads, READ_ARENA *arena, unsigned int num );
 int process_single_thread_SE_C( const ktrim_param &kp );
-int process_multi_thread_SE_C(  const ktrim_param &kp );
+int process_multi_thread_SE_C(  const ktrim_param &kp, const ktrim_param *samples, unsigned int nsample );
 
 #endif
 
@@ -0,0 +1,392 @@
+/**
+ * Author: Ktrim contributors
+ * Date: Oct 2026
+ * Block-based FASTQ reader: large read() calls (or mmap, or zlib) plus memchr-based line scanning
+ * This program is part of the Ktrim package
+**/
+
+#ifndef _KTRIM_FQ_READER_
+#define _KTRIM_FQ_READER_
+
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "common.h"
+#include "gz_reader.h"
+
+using namespace std;
+
+/*
+ * update in v1.7: if use_mmap is set, regular files are mapped into memory and the reads point
+ * into the mapped file directly (zero-copy); otherwise (or if mmap fails, e.g., for pipes),
+ * the file is loaded block by block
+ * Gzipped files (with .gz suffix) are decompressed into the buffer, using nthread threads
+ * if the file consists of multiple members (e.g., BGZF), or a checkpoint index is used (gz_index),
+ * see gz_reader.h
+*/
+FQ_READER * fq_reader_open( const char *file, bool use_mmap, unsigned int nthread, bool gz_index ) {
+	int fd = open( file, O_RDONLY );
+	if( fd < 0 )
+		return NULL;
+
+	FQ_READER *fr = new FQ_READER;
+	fr->type  = FQ_PLAIN;
+	fr->fd    = fd;
+	fr->gfp   = NULL;
+	fr->pgz   = NULL;
+	fr->start = 0;
+	fr->end   = 0;
+	fr->eof   = false;
+	fr->error = false;
+	fr->pf    = NULL;
+	fr->readahead = false;
+	fr->hinted = 0;
+
+	register size_t len = strlen( file );
+	bool is_gz = ( len>3 && file[len-3]=='.' && file[len-2]=='g' && file[len-1]=='z' );
+
+	struct stat st;
+	if( is_gz ) {
+		if( nthread > 1 || gz_index )
+			fr->pgz = pgz_open( fd, nthread, gz_index ? file : NULL );
+		if( fr->pgz != NULL ) {
+			fr->type = FQ_PGZIP;
+		} else {
+			fr->type = FQ_GZIP;
+			fr->gfp = gzdopen( fd, "rb" );
+			if( fr->gfp == NULL ) {
+				close( fd );
+				delete fr;
+				return NULL;
+			}
+			gzbuffer( fr->gfp, 1 << 17 );
+		}
+	} else if( use_mmap && fstat(fd, &st)==0 && S_ISREG(st.st_mode) && st.st_size>0 ) {
+		void *map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+		if( map != MAP_FAILED ) {
+			madvise( map, st.st_size, MADV_SEQUENTIAL );
+			fr->type     = FQ_MMAP;
+			fr->buffer   = (char *) map;
+			fr->capacity = st.st_size;
+			fr->end      = st.st_size;
+			fr->eof      = true;
+			return fr;
+		}
+	}
+
+#ifdef POSIX_FADV_SEQUENTIAL
+	if( fr->type != FQ_GZIP )
+		posix_fadvise( fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+#endif
+	fr->capacity = FQ_BLOCK_SIZE;
+	fr->buffer = (char *) malloc( fr->capacity );
+
+	return fr;
+}
+
+void fq_prefetch_stop( FQ_PREFETCH *pf );
+
+void fq_reader_close( FQ_READER *fr ) {
+	if( fr->pf != NULL )
+		fq_prefetch_stop( fr->pf );
+
+	if( fr->type == FQ_MMAP ) {
+		munmap( fr->buffer, fr->capacity );
+	} else {
+		free( fr->buffer );
+	}
+
+	if( fr->type == FQ_GZIP ) {
+		gzclose( fr->gfp );	// fd is closed as well
+	} else {
+		if( fr->type == FQ_PGZIP )
+			pgz_close( fr->pgz );
+		close( fr->fd );
+	}
+	delete fr;
+}
+
+// read at most len bytes from fd; returns the number of bytes read, 0 for EOF and -1 for error
+long fq_read_fd( int fd, char *buf, size_t len ) {
+	while( true ) {
+		ssize_t n = read( fd, buf, len );
+		if( n >= 0 )
+			return n;
+		if( errno != EINTR ) {
+			cerr << "\033[1;31mError: read fastq file failed!\033[0m\n";
+			return -1;
+		}
+	}
+}
+
+/*
+ * update in v1.7: in single- and two-thread modes, the reading thread also trims the reads, therefore
+ * the file is read ahead in the background: for plain-text files, an I/O helper thread reads the
+ * next block while the current one is being parsed (i.e., double buffering), and asks the kernel to
+ * start reading the block after it (POSIX_FADV_WILLNEED); for Gzipped files, which are decompressed
+ * by the reading thread itself, only the readahead hints are given
+ * mapped files are already read ahead by the kernel (MADV_SEQUENTIAL)
+*/
+void fq_prefetch_worker( FQ_READER *fr ) {
+	register FQ_PREFETCH *pf = fr->pf;
+	register size_t offset = 0;
+	unique_lock<mutex> lock( pf->lock );
+	while( true ) {
+		pf->cond.wait( lock, [pf]{ return ! pf->ready || pf->quit; } );
+		if( pf->quit )
+			break;
+
+		lock.unlock();
+		register long n = fq_read_fd( fr->fd, pf->block, FQ_BLOCK_SIZE );
+#ifdef POSIX_FADV_WILLNEED
+		if( n > 0 ) {
+			offset += n;
+			posix_fadvise( fr->fd, offset, FQ_BLOCK_SIZE, POSIX_FADV_WILLNEED );
+		}
+#endif
+		lock.lock();
+
+		pf->size = n;
+		pf->used = 0;
+		pf->ready = true;
+		pf->cond.notify_all();
+		if( n <= 0 )
+			break;
+	}
+}
+
+void fq_reader_prefetch( FQ_READER *fr ) {
+	if( fr->type == FQ_GZIP ) {
+		fr->readahead = true;
+		return;
+	}
+	if( fr->type != FQ_PLAIN )
+		return;
+
+	register FQ_PREFETCH *pf = new FQ_PREFETCH;
+	pf->block = new char[ FQ_BLOCK_SIZE ];
+	pf->size  = 0;
+	pf->used  = 0;
+	pf->ready = false;
+	pf->quit  = false;
+	fr->pf = pf;
+	pf->helper = thread( fq_prefetch_worker, fr );
+}
+
+void fq_prefetch_stop( FQ_PREFETCH *pf ) {
+	{
+		lock_guard<mutex> lock( pf->lock );
+		pf->quit = true;
+	}
+	pf->cond.notify_all();
+	pf->helper.join();
+	delete [] pf->block;
+	delete pf;
+}
+
+// take at most len bytes from the prefetched block
+long fq_prefetch_take( FQ_PREFETCH *pf, char *buf, size_t len ) {
+	unique_lock<mutex> lock( pf->lock );
+	pf->cond.wait( lock, [pf]{ return pf->ready; } );
+	if( pf->size <= 0 )		// EOF or error, the helper thread has finished
+		return pf->size;
+
+	register size_t n = pf->size - pf->used;
+	if( n > len )
+		n = len;
+	memcpy( buf, pf->block + pf->used, n );
+	pf->used += n;
+	if( pf->used == (size_t) pf->size ) {
+		pf->ready = false;
+		pf->cond.notify_all();
+	}
+	return n;
+}
+
+// load more data into buffer[end, capacity); returns the number of bytes loaded, 0 for EOF and -1 for error
+long fq_reader_load( FQ_READER *fr ) {
+	register size_t len = fr->capacity - fr->end;
+	if( fr->type == FQ_GZIP ) {
+#ifdef POSIX_FADV_WILLNEED
+		if( fr->readahead ) {
+			register size_t offset = gzoffset( fr->gfp );
+			if( offset + FQ_BLOCK_SIZE > fr->hinted ) {
+				posix_fadvise( fr->fd, offset, FQ_READAHEAD_SIZE, POSIX_FADV_WILLNEED );
+				fr->hinted = offset + FQ_READAHEAD_SIZE;
+			}
+		}
+#endif
+		int n = gzread( fr->gfp, fr->buffer + fr->end, len > INT_MAX ? INT_MAX : len );
+		if( n <= 0 ) {
+			int err;
+			gzerror( fr->gfp, &err );
+			if( err == Z_BUF_ERROR ) {
+				cerr << "\033[1;31mError: unexpected end of Gzipped file!\033[0m\n";
+				return -1;
+			} else if( err != Z_OK ) {
+				cerr << "\033[1;31mError: the Gzipped file is corrupted!\033[0m\n";
+				return -1;
+			}
+		}
+		return n;
+	}
+
+	if( fr->type == FQ_PGZIP )
+		return pgz_read( fr->pgz, fr->buffer + fr->end, len );
+
+	if( fr->pf != NULL )
+		return fq_prefetch_take( fr->pf, fr->buffer + fr->end, len );
+
+	return fq_read_fd( fr->fd, fr->buffer + fr->end, len );
+}
+
+/*
+ * move the un-parsed tail (i.e., a partial record) to the head of the buffer and
+ * fill the rest with another block from the file; the buffer is doubled when a
+ * single record does not fit into it
+ * returns false if no more data could be loaded; fr->error is set if it is not the end of the file
+*/
+bool fq_reader_refill( FQ_READER *fr ) {
+	if( fr->eof )
+		return false;
+
+	register size_t left = fr->end - fr->start;
+	if( fr->start != 0 ) {
+		memmove( fr->buffer, fr->buffer + fr->start, left );
+		fr->start = 0;
+		fr->end   = left;
+	}
+	if( fr->end == fr->capacity ) {
+		fr->capacity <<= 1;
+		fr->buffer = (char *) realloc( fr->buffer, fr->capacity );
+	}
+
+	long n = fq_reader_load( fr );
+	if( n <= 0 ) {
+		fr->eof = true;
+		fr->error = ( n < 0 );
+		return false;
+	}
+	fr->end += n;
+	return true;
+}
+
+/*
+ * locate the next 4-line record in the buffer; the pointers in rec are valid until the next call
+ * the record boundaries are found by memchr, which is SIMD-accelerated in glibc
+ * nothing is written to the buffer, therefore it works on read-only mapped files
+ * returns false if there is no more (complete) record
+*/
+bool fq_reader_next( FQ_READER *fr, FQ_RECORD *rec ) {
+	char *line[5];
+	while( true ) {
+		register char *s = fr->buffer + fr->start;
+		register char *e = fr->buffer + fr->end;
+		register char *p = s;
+		register int i;
+
+		line[0] = s;
+		for( i=1; i!=5; ++i ) {
+			p = (char *) memchr( p, '\n', e - p );
+			if( p == NULL )
+				break;
+			line[i] = ++p;
+		}
+
+		if( i != 5 ) {	// partial record at the end of the buffer
+			if( fq_reader_refill( fr ) )
+				continue;
+
+			// the last line of the file may have no '\n'
+			if( i == 4 && line[3] != e ) {
+				line[4] = e + 1;
+			} else {
+				if( s != e && ! fr->error )	// the data is cut by the error otherwise
+					cerr << "\033[1;32mWarning: incomplete record at the end of fastq file is ignored!\033[0m\n";
+				fr->start = fr->end;
+				return false;
+			}
+		}
+
+		rec->id   = line[0];
+		rec->seq  = line[1];
+		rec->qual = line[3];
+		rec->id_len   = line[1] - line[0];		// including the tailing '\n'
+		rec->seq_len  = line[2] - line[1] - 1;
+		rec->qual_len = line[4] - line[3] - 1;
+
+		fr->start = ( line[4] > e ) ? fr->end : line[4] - fr->buffer;
+		return true;
+	}
+}
+
+/*
+ * update in v1.7: a list of input files (e.g., several lanes) is processed as a single stream,
+ * and the next file is opened while the current one is being processed, so that it is read ahead
+ * (prefetch, see fq_reader_prefetch) or decompressed ahead (multi-member Gzip files, see pgz_open)
+ * when the current file reaches its end
+*/
+void fq_list_open_ahead( FQ_LIST *fl ) {
+	fl->ahead = NULL;
+	if( fl->next == fl->files->size() )
+		return;
+	fl->ahead = fq_reader_open( (*fl->files)[fl->next].c_str(), fl->use_mmap, fl->nthread, fl->gz_index );
+	if( fl->ahead != NULL && fl->prefetch )
+		fq_reader_prefetch( fl->ahead );
+}
+
+void fq_list_open( FQ_LIST *fl, const vector<string> &files, bool use_mmap, unsigned int nthread, bool gz_index, bool prefetch ) {
+	fl->files    = &files;
+	fl->next     = 0;
+	fl->use_mmap = use_mmap;
+	fl->nthread  = nthread;
+	fl->gz_index = gz_index;
+	fl->prefetch = prefetch;
+	fq_list_open_ahead( fl );
+}
+
+/*
+ * returns the next file of the list, and opens the one after it
+ * returns NULL at the end of the list, or if the file could not be opened (failed is set)
+*/
+FQ_READER * fq_list_next( FQ_LIST *fl, bool &failed ) {
+	failed = false;
+	if( fl->next == fl->files->size() )
+		return NULL;
+
+	FQ_READER *fr = fl->ahead;
+	++ fl->next;
+	if( fr == NULL ) {
+		failed = true;
+		return NULL;
+	}
+	fq_list_open_ahead( fl );
+	return fr;
+}
+
+// close the file opened in advance (e.g., for errors)
+void fq_list_close( FQ_LIST *fl ) {
+	if( fl->ahead != NULL )
+		fq_reader_close( fl->ahead );
+	fl->ahead = NULL;
+}
+
+// whether all the data in the file has been consumed
+bool fq_reader_eof( FQ_READER *fr ) {
+	if( fr->start == fr->end )
+		fq_reader_refill( fr );
+	return fr->start == fr->end;
+}
+
+#endif
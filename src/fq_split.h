@@ -0,0 +1,229 @@
+/**
+ * Author: Ktrim contributors
+ * Date: Oct 2026
+ * Parallel parsing of memory-mapped plain-text FASTQ files by byte ranges
+ * This program is part of the Ktrim package
+**/
+
+#ifndef _KTRIM_FQ_SPLIT_
+#define _KTRIM_FQ_SPLIT_
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <memory.h>
+#include <omp.h>
+#include "common.h"
+#include "util.h"
+#include "fq_reader.h"
+
+using namespace std;
+
+/*
+ * update in v1.7: with a single reader thread, parsing becomes the bottleneck beyond ~8 threads
+ * therefore, when all the input files could be mapped into memory, each file is cut into segments of
+ * FQ_SEGMENT_SIZE bytes, and the segments are indexed in parallel: the start of each segment is moved
+ * to the next record boundary (a line starting with '@' whose next-next line starts with '+'), then
+ * its records are counted and the offset of every FQ_CHECKPOINT_RECORDS records is kept
+ * with the index, batch n (i.e., records [n*batch_size, (n+1)*batch_size) of a file, the same
+ * as the sequential reader) could be located and parsed by any thread independently; for paired-end
+ * data, read1 and read2 are paired by the record number instead of the byte offset
+*/
+
+// the first record boundary at or after pos; returns size if there is none
+size_t fq_resync( const char *buf, size_t size, size_t pos ) {
+	if( pos == 0 )
+		return 0;
+
+	register const char *e = buf + size;
+	register const char *p = buf + pos - 1;		// a line starts at pos if buf[pos-1] is '\n'
+	while( true ) {
+		p = (const char *) memchr( p, '\n', e - p );
+		if( p == NULL || ++p == e )
+			return size;
+		if( *p != '@' )
+			continue;
+
+		register const char *q = (const char *) memchr( p, '\n', e - p );
+		if( q == NULL )
+			return size;
+		q = (const char *) memchr( q+1, '\n', e - q - 1 );
+		if( q == NULL || q+1 == e )
+			return size;
+		if( q[1] == '+' )
+			return p - buf;
+	}
+}
+
+// a reader on records [start, end) of the mapped file
+void inline fq_split_view( const FQ_SPLIT *sp, size_t start, size_t end, FQ_READER *view ) {
+	*view = *sp->fr;
+	view->start = start;
+	view->end   = end;
+}
+
+// count the records of a segment and record the checkpoints
+void fq_split_count( FQ_SPLIT *sp, FQ_SEGMENT *seg ) {
+	FQ_READER view;
+	FQ_RECORD rec;
+	fq_split_view( sp, seg->start, seg->end, &view );
+
+	register unsigned long n = 0;
+	seg->checkpoint.clear();
+	while( true ) {
+		if( n % FQ_CHECKPOINT_RECORDS == 0 )
+			seg->checkpoint.push_back( view.start );
+		if( ! fq_reader_next( &view, &rec ) )
+			break;
+		++ n;
+	}
+	seg->nrecord = n;
+}
+
+/*
+ * open the files and index them with nthread threads
+ * returns NULL (and nothing is kept open) if any file could not be mapped, e.g., Gzipped files, pipes
+ * or empty files
+*/
+FQ_SPLIT * fq_split_open( const vector<string> &files, unsigned int nthread ) {
+	FQ_SPLIT *splits = new FQ_SPLIT[ files.size() ];
+	register unsigned int i, j;
+	for( i=0; i!=files.size(); ++i ) {
+		splits[i].fr = fq_reader_open( files[i].c_str(), true, 1, false );
+		if( splits[i].fr == NULL || splits[i].fr->type != FQ_MMAP ) {
+			if( splits[i].fr != NULL )
+				fq_reader_close( splits[i].fr );
+			for( j=0; j!=i; ++j )
+				fq_reader_close( splits[j].fr );
+			delete [] splits;
+			return NULL;
+		}
+		// the batches are parsed in parallel, so the access pattern is no longer sequential
+		madvise( splits[i].fr->buffer, splits[i].fr->capacity, MADV_NORMAL );
+	}
+
+	// cut the files into segments
+	vector<unsigned int> job_file, job_seg;
+	for( i=0; i!=files.size(); ++i ) {
+		register FQ_SPLIT *sp = splits + i;
+		register size_t size = sp->fr->capacity;
+		register size_t nseg = size / FQ_SEGMENT_SIZE + 1;
+		sp->segments.resize( nseg );
+		for( j=0; j!=nseg; ++j ) {
+			sp->segments[j].start = fq_resync( sp->fr->buffer, size, size / nseg * j );
+			if( j )
+				sp->segments[j-1].end = sp->segments[j].start;
+			job_file.push_back( i );
+			job_seg.push_back( j );
+		}
+		sp->segments[nseg-1].end = size;
+	}
+
+	// count the records in parallel
+	register int njob = job_file.size();
+	register int k;
+	#pragma omp parallel for num_threads(nthread) schedule(dynamic)
+	for( k=0; k<njob; ++k )
+		fq_split_count( splits + job_file[k], &splits[job_file[k]].segments[job_seg[k]] );
+
+	for( i=0; i!=files.size(); ++i ) {
+		register FQ_SPLIT *sp = splits + i;
+		sp->nrecord = 0;
+		for( j=0; j!=sp->segments.size(); ++j ) {
+			sp->segments[j].first = sp->nrecord;
+			sp->nrecord += sp->segments[j].nrecord;
+		}
+	}
+	return splits;
+}
+
+void fq_split_close( FQ_SPLIT *splits, unsigned int nfile ) {
+	if( splits == NULL )
+		return;
+	for( unsigned int i=0; i!=nfile; ++i )
+		fq_reader_close( splits[i].fr );
+	delete [] splits;
+}
+
+// the offset of record k in the file
+size_t fq_split_locate( const FQ_SPLIT *sp, unsigned long k ) {
+	if( k >= sp->nrecord )
+		return sp->fr->capacity;
+
+	// the last segment whose first record is no larger than k
+	register unsigned int lo = 0, hi = sp->segments.size();
+	while( hi - lo > 1 ) {
+		register unsigned int mid = (lo + hi) >> 1;
+		if( sp->segments[mid].first <= k )
+			lo = mid;
+		else
+			hi = mid;
+	}
+	register const FQ_SEGMENT *seg = &sp->segments[lo];
+	k -= seg->first;
+
+	FQ_READER view;
+	FQ_RECORD rec;
+	fq_split_view( sp, seg->checkpoint[ k / FQ_CHECKPOINT_RECORDS ], seg->end, &view );
+	for( k %= FQ_CHECKPOINT_RECORDS; k; --k )
+		fq_reader_next( &view, &rec );
+	return view.start;
+}
+
+/*
+ * cut the files into batches of batch_size reads, the same as the sequential reader
+ * for paired-end data, read1 and read2 files must have the same number of records
+ * returns false if they do not
+*/
+bool fq_split_ranges( const FQ_SPLIT *sp1, const FQ_SPLIT *sp2, unsigned int nfile, unsigned int batch_size,
+						vector<FQ_RANGE> &ranges ) {
+	ranges.clear();
+	for( unsigned int i=0; i!=nfile; ++i ) {
+		if( sp2 != NULL && sp1[i].nrecord != sp2[i].nrecord ) {
+			cerr << "ERROR: unequal read number for read1 (" << sp1[i].nrecord << ") and read2 (" << sp2[i].nrecord << ")!\n";
+			return false;
+		}
+		FQ_RANGE r;
+		r.fileCnt = i;
+		for( r.first=0; r.first < sp1[i].nrecord; r.first += batch_size ) {
+			r.num = ( sp1[i].nrecord - r.first < batch_size ) ? sp1[i].nrecord - r.first : batch_size;
+			ranges.push_back( r );
+		}
+	}
+	return true;
+}
+
+// load the reads of range r; the reads point into the mapped files
+void fq_split_load_SE( const FQ_SPLIT *sp, const FQ_RANGE *r, CSEREAD *reads ) {
+	FQ_READER view;
+	FQ_RECORD rec;
+	sp += r->fileCnt;
+	fq_split_view( sp, fq_split_locate(sp, r->first), sp->fr->capacity, &view );
+
+	register CSEREAD *p = reads;
+	register CSEREAD *q = p + r->num;
+	for( ; p != q; ++p ) {
+		fq_reader_next( &view, &rec );
+		p->size = fill_read( &view, &rec, NULL, p->id, p->id_len, p->seq, p->qual );
+	}
+}
+
+void fq_split_load_PE( const FQ_SPLIT *sp1, const FQ_SPLIT *sp2, const FQ_RANGE *r, CPEREAD *reads ) {
+	FQ_READER view1, view2;
+	FQ_RECORD rec;
+	sp1 += r->fileCnt;
+	sp2 += r->fileCnt;
+	fq_split_view( sp1, fq_split_locate(sp1, r->first), sp1->fr->capacity, &view1 );
+	fq_split_view( sp2, fq_split_locate(sp2, r->first), sp2->fr->capacity, &view2 );
+
+	register CPEREAD *p = reads;
+	register CPEREAD *q = p + r->num;
+	for( ; p != q; ++p ) {
+		fq_reader_next( &view1, &rec );
+		p->size  = fill_read( &view1, &rec, NULL, p->id1, p->id1_len, p->seq1, p->qual1 );
+		fq_reader_next( &view2, &rec );
+		p->size2 = fill_read( &view2, &rec, NULL, p->id2, p->id2_len, p->seq2, p->qual2 );
+	}
+}
+
+#endif
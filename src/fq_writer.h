@@ -0,0 +1,243 @@
+/**
+ * Author: Ktrim contributors
+ * Date: Oct 2026
+ * Ordered output queue: the working threads hand over their write buffers and the writer threads
+ * write them to the output files in order
+ * This program is part of the Ktrim package
+**/
+
+#ifndef _KTRIM_FQ_WRITER_
+#define _KTRIM_FQ_WRITER_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "common.h"
+#include "util.h"
+#include "gz_writer.h"
+
+using namespace std;
+
+/*
+ * update in v1.7: each piece of output (i.e., the reads of a batch trimmed by 1 working thread)
+ * gets a sequence number, and is stored in slot (seq % nslot) of the write buffers
+ * there is 1 writer thread per output file (i.e., read1 and read2 are written concurrently),
+ * which writes the slots in the order of the sequence numbers
+ * a working thread only waits if its slot has not been written yet (i.e., the writers are
+ * nslot pieces behind), instead of waiting for the other working threads to finish
+ *
+ * in multi-sample mode, the pieces of the samples follow each other in the queue, and the writers
+ * switch to the output files of the next sample at the boundaries (see oq_set_sample)
+*/
+
+/*
+ * write slot k to output file f (0 for read1 or stdout, 1 for read2) of the sample
+ * returns false if the write fails
+*/
+bool oq_write_slot( OUT_QUEUE *oq, unsigned int k, unsigned int f, unsigned int sample ) {
+	register writeBuffer *wb = oq->wb;
+	register const ktrim_param *kp = oq->kp + sample;
+	FILE *fp = f ? kp->fout2 : kp->fout1;
+
+	if( kp->use_writev ) {
+		if( f )
+			return writev_all( fileno(fp), wb->iov2[k], wb->iov2n[k] );
+		else
+			return writev_all( fileno(fp), wb->iov1[k], wb->iov1n[k] );
+	} else if( kp->gzip_output ) {
+		const char *out = f ? wb->gzbuffer2[k] : wb->gzbuffer1[k];
+		unsigned int out_size = f ? wb->gz2stored[k] : wb->gz1stored[k];
+		if( fwrite( out, sizeof(char), out_size, fp ) != out_size )
+			return false;
+		if( kp->write_gzi )
+			return bgzf_write_index( f ? kp->fgzi2 : kp->fgzi1, out, out_size, wb->coffset[f], wb->uoffset[f] );
+	} else {
+		if( f )
+			return fwrite( wb->buffer2[k], sizeof(char), wb->b2stored[k], fp ) == wb->b2stored[k];
+		else
+			return fwrite( wb->buffer1[k], sizeof(char), wb->b1stored[k], fp ) == wb->b1stored[k];
+	}
+	return true;
+}
+
+/*
+ * flush output file f of the sample when the writer leaves it: the data kept in the stdio buffer
+ * could fail to be written as well, which fwrite does not report
+*/
+bool oq_flush( OUT_QUEUE *oq, unsigned int f, unsigned int sample ) {
+	register const ktrim_param *kp = oq->kp + sample;
+	FILE *fp = f ? kp->fout2 : kp->fout1;
+	register bool ok = ( fflush( fp ) == 0 && ! ferror( fp ) );
+	if( kp->write_gzi ) {
+		fp = f ? kp->fgzi2 : kp->fgzi1;
+		ok = ( fflush( fp ) == 0 && ! ferror( fp ) ) && ok;
+	}
+	return ok;
+}
+
+// number of pieces that have been written to all the output files; the lock must be held
+unsigned long inline oq_done( const OUT_QUEUE *oq ) {
+	return ( oq->nfile == 2 && oq->written[1] < oq->written[0] ) ? oq->written[1] : oq->written[0];
+}
+
+// report a failed write; the lock must be held
+void inline oq_set_error( OUT_QUEUE *oq ) {
+	if( ! oq->error ) {
+		cerr << "\033[1;31mError: write file failed!\033[0m\n";
+		oq->error = true;
+	}
+}
+
+/*
+ * if a write fails, the error is reported once and the writers keep taking the pieces without
+ * writing them, so that no working thread is blocked; the handlers stop at the next batch (see
+ * oq_failed) and return 103
+*/
+void oq_writer( OUT_QUEUE *oq, unsigned int f ) {
+	unsigned int sample = 0;
+	unsigned int next_sample = 0;	// the next boundary in sample_seq
+	unique_lock<mutex> lock( oq->lock );
+	while( true ) {
+		oq->slot_ready.wait( lock, [oq, f]{
+			return oq->ready[ oq->written[f] % oq->nslot ] == oq->written[f] + 1 || oq->quit; } );
+		register unsigned long seq = oq->written[f];
+		if( oq->ready[ seq % oq->nslot ] != seq + 1 )	// quit and nothing left
+			break;
+		register unsigned int prev = sample;
+		while( next_sample < oq->sample_seq.size() && oq->sample_seq[next_sample] <= seq ) {
+			sample = oq->sample_id[ next_sample ++ ];
+			oq->wb->coffset[f] = oq->wb->uoffset[f] = 0;	// the .gzi index of a new file
+		}
+
+		register bool skip = oq->error;
+		lock.unlock();
+		register bool ok = skip || ( ( prev == sample || oq_flush( oq, f, prev ) ) &&
+									 oq_write_slot( oq, seq % oq->nslot, f, sample ) );
+		lock.lock();
+		if( ! ok )
+			oq_set_error( oq );
+
+		++ oq->written[f];
+		oq->slot_free.notify_all();
+	}
+	if( ! oq->error && ! oq_flush( oq, f, sample ) )
+		oq_set_error( oq );
+}
+
+/*
+ * update in v1.7: free the write buffers and the statistics of the working threads, on success or errors
+ * paired_end is false for the write buffers of single-end data, which have no buffer2
+*/
+void free_kstat_wrbuffer( ktrim_stat &kstat, writeBuffer &writebuffer, unsigned int nslot, bool paired_end, const ktrim_param &kp ) {
+	for( unsigned int i=0; i!=nslot; ++i ) {
+		delete [] writebuffer.buffer1[i];
+		if( paired_end && ! kp.write2stdout )
+			delete [] writebuffer.buffer2[i];
+	}
+	delete [] writebuffer.buffer1;
+	delete [] writebuffer.b1stored;
+	delete [] writebuffer.b1capacity;
+	if( paired_end ) {
+		delete [] writebuffer.buffer2;
+		delete [] writebuffer.b2stored;
+		delete [] writebuffer.b2capacity;
+	}
+	if( kp.gzip_output )
+		free_gz_wrbuffer( writebuffer, nslot );
+	if( kp.use_writev )
+		free_iov_wrbuffer( writebuffer, nslot );
+
+	delete [] kstat.dropped;
+	delete [] kstat.real_adapter;
+	delete [] kstat.tail_adapter;
+	delete [] kstat.dimer;
+	delete [] kstat.pass;
+}
+
+/*
+ * start the writer threads; wb must have nslot buffers, and nslot should be no less than the number
+ * of working threads, otherwise the working threads of the same batch block each other
+ * in multi-sample mode, kp is the first element of the array of the samples
+*/
+void oq_open( OUT_QUEUE *oq, writeBuffer *wb, unsigned int nslot, const ktrim_param &kp ) {
+	oq->wb = wb;
+	oq->kp = &kp;
+	oq->nslot = nslot;
+	oq->ready = new unsigned long [ nslot ];
+	for( unsigned int i=0; i!=nslot; ++i )
+		oq->ready[i] = 0;
+	oq->next_seq = 0;
+	oq->written[0] = oq->written[1] = 0;
+	oq->nfile = ( kp.paired_end_data && !kp.write2stdout ) ? 2 : 1;
+	oq->sample_seq.clear();
+	oq->sample_id.clear();
+	oq->quit = false;
+	oq->error = false;
+
+	oq->writers = new thread[ oq->nfile ];
+	for( unsigned int i=0; i!=oq->nfile; ++i )
+		oq->writers[i] = thread( oq_writer, oq, i );
+}
+
+// the pieces from seq on belong to the sample; must be called before these pieces are submitted
+void oq_set_sample( OUT_QUEUE *oq, unsigned long seq, unsigned int sample ) {
+	lock_guard<mutex> lock( oq->lock );
+	oq->sample_seq.push_back( seq );
+	oq->sample_id.push_back( sample );
+}
+
+// wait until the piece seq could be stored, and return its slot
+unsigned int oq_acquire( OUT_QUEUE *oq, unsigned long seq ) {
+	unique_lock<mutex> lock( oq->lock );
+	oq->slot_free.wait( lock, [oq, seq]{ return seq < oq_done(oq) + oq->nslot; } );
+	return seq % oq->nslot;
+}
+
+// the piece seq is ready for writing
+void oq_submit( OUT_QUEUE *oq, unsigned long seq ) {
+	{
+		lock_guard<mutex> lock( oq->lock );
+		oq->ready[ seq % oq->nslot ] = seq + 1;
+	}
+	oq->slot_ready.notify_all();
+}
+
+// whether a write has failed
+bool oq_failed( OUT_QUEUE *oq ) {
+	lock_guard<mutex> lock( oq->lock );
+	return oq->error;
+}
+
+/*
+ * wait until all the pieces before seq have been written
+ * this is needed before the loaded reads are overwritten (or the mapped file is closed) in writev mode
+*/
+void oq_wait( OUT_QUEUE *oq, unsigned long seq ) {
+	unique_lock<mutex> lock( oq->lock );
+	oq->slot_free.wait( lock, [oq, seq]{ return oq_done(oq) >= seq; } );
+}
+
+// stop the writer threads; the pieces that are not ready yet are discarded (e.g., for errors)
+void oq_abort( OUT_QUEUE *oq ) {
+	{
+		lock_guard<mutex> lock( oq->lock );
+		oq->quit = true;
+	}
+	oq->slot_ready.notify_all();
+	for( unsigned int i=0; i!=oq->nfile; ++i )
+		oq->writers[i].join();
+
+	delete [] oq->writers;
+	delete [] oq->ready;
+}
+
+// write all the pieces and stop the writer threads; returns false if a write has failed
+bool oq_close( OUT_QUEUE *oq ) {
+	oq_wait( oq, oq->next_seq );
+	oq_abort( oq );
+	return ! oq->error;
+}
+
+#endif
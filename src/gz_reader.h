@@ -0,0 +1,596 @@
+/**
+ * Author: Ktrim contributors
+ * Date: Oct 2026
+ * Parallel decompression of BGZF and multi-member Gzip files
+ * This program is part of the Ktrim package
+**/
+
+#ifndef _KTRIM_GZ_READER_
+#define _KTRIM_GZ_READER_
+
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <string>
+#include <zlib.h>
+#include "common.h"
+
+using namespace std;
+
+/*
+ * the idea: a Gzip file could be a concatenation of many independent members (e.g., BGZF files
+ * written by bgzip/samtools, or files compressed by "pigz --independent" or by concatenating
+ * Gzipped chunks), and each member could be inflated independently
+ * the compressed file is mapped into memory and cut into jobs of complete members, which are
+ * inflated by the worker threads and consumed in order by the reading thread
+ *
+ * BGZF blocks record their own size, therefore the cutting is exact; for other files, the job
+ * ends at a candidate member header found by scanning, which could be a false hit inside the
+ * compressed data. Such jobs fail (a member must end exactly at the job end), and then the
+ * reading thread inflates the data by itself from the last known member boundary.
+ * The same is used for files with 1 (large) member, which can not be split.
+ *
+ * update in v1.7: for files with 1 member, a checkpoint index could be built while the reading
+ * thread inflates the file, which records the state of the inflation (i.e., the bit offset and
+ * the 32 KB window) every GZ_INDEX_SPAN bytes of output (the same as zran.c in zlib); if a valid
+ * index exists, the jobs are cut by the checkpoints and inflated in parallel
+*/
+
+// whether p looks like the header of a gzip member
+bool inline is_gzip_header( const unsigned char *p, size_t n ) {
+	if( n < GZIP_MIN_MEMBER )
+		return false;
+	return p[0]==0x1f && p[1]==0x8b && p[2]==8 && (p[3]&0xe0)==0 &&
+			(p[8]==0 || p[8]==2 || p[8]==4) && (p[9]<=13 || p[9]==255);
+}
+
+// size of the BGZF block starting at p (from the BSIZE field), or 0 if it is not a BGZF block
+size_t bgzf_block_size( const unsigned char *p, size_t n ) {
+	if( !is_gzip_header(p, n) || (p[3]&4)==0 )	// no FEXTRA
+		return 0;
+
+	register size_t xlen = p[10] | (p[11]<<8);
+	if( 12 + xlen > n )
+		return 0;
+
+	register size_t i = 12;
+	while( i + 4 <= 12 + xlen ) {
+		register size_t slen = p[i+2] | (p[i+3]<<8);
+		if( p[i]=='B' && p[i+1]=='C' && slen==2 && i+6<=12+xlen )
+			return (p[i+4] | (p[i+5]<<8)) + 1;
+		i += 4 + slen;
+	}
+	return 0;
+}
+
+// find the first candidate member header in [from, to); returns to if there is none
+size_t find_gzip_member( const unsigned char *data, size_t size, size_t from, size_t to ) {
+	while( from < to ) {
+		const unsigned char *p = (const unsigned char *) memchr( data+from, 0x1f, to-from );
+		if( p == NULL )
+			return to;
+		from = p - data;
+		if( is_gzip_header( p, size-from ) )
+			return from;
+		++ from;
+	}
+	return to;
+}
+
+// offset of the k-th checkpoint in the index file
+off_t inline pgz_point_offset( unsigned int k ) {
+	return sizeof(GZ_INDEX_HEADER) + (off_t)k * (sizeof(GZ_POINT) + GZ_WINDOW_SIZE);
+}
+
+/*
+ * load the checkpoints from the index file; the windows are loaded by the workers when needed
+ * returns false if there is no valid index for this file
+*/
+bool pgz_load_index( PGZ_READER *pgz ) {
+	int fd = open( pgz->index_file, O_RDONLY );
+	if( fd < 0 )
+		return false;
+
+	GZ_INDEX_HEADER h;
+	if( pread(fd, &h, sizeof(h), 0) != sizeof(h) || memcmp(h.magic, GZ_INDEX_MAGIC, 8) != 0 ||
+			h.file_size != pgz->size || h.file_mtime != pgz->file_mtime || h.npoint == 0 ) {
+		close( fd );
+		return false;
+	}
+
+	pgz->points = (GZ_POINT *) malloc( h.npoint * sizeof(GZ_POINT) );
+	for( unsigned int k=0; k!=h.npoint; ++k ) {
+		if( pread(fd, pgz->points+k, sizeof(GZ_POINT), pgz_point_offset(k)) != sizeof(GZ_POINT) ) {
+			free( pgz->points );
+			pgz->points = NULL;
+			close( fd );
+			return false;
+		}
+	}
+	pgz->npoint = h.npoint;
+	pgz->point_capacity = h.npoint;
+	pgz->index_fd = fd;
+	return true;
+}
+
+// start to build the index while the reading thread inflates the file from the beginning
+void pgz_start_index( PGZ_READER *pgz ) {
+	string tmp = string(pgz->index_file) + ".tmp";
+	pgz->index_out = fopen( tmp.c_str(), "wb" );
+	if( pgz->index_out == NULL ) {
+		cerr << "\033[1;32mWarning: could not write Gzip index file '" << tmp << "'!\033[0m\n";
+		return;
+	}
+
+	GZ_INDEX_HEADER h;
+	memset( &h, 0, sizeof(h) );
+	fwrite( &h, sizeof(h), 1, pgz->index_out );
+	pgz->npoint = 0;
+}
+
+// record a checkpoint at the current position of the sequential inflation
+void pgz_add_point( PGZ_READER *pgz ) {
+	if( pgz->npoint == pgz->point_capacity ) {
+		pgz->point_capacity = pgz->point_capacity ? pgz->point_capacity<<1 : 256;
+		pgz->points = (GZ_POINT *) realloc( pgz->points, pgz->point_capacity * sizeof(GZ_POINT) );
+	}
+	GZ_POINT *pt = pgz->points + pgz->npoint;
+	++ pgz->npoint;
+
+	unsigned char window[ GZ_WINDOW_SIZE ];
+	uInt wsize = GZ_WINDOW_SIZE;
+	inflateGetDictionary( &pgz->zs, window, &wsize );
+	memset( window+wsize, 0, GZ_WINDOW_SIZE-wsize );
+
+	pt->out  = pgz->zs.total_out;
+	pt->in   = pgz->seq_pos;
+	pt->bits = pgz->zs.data_type & 7;
+	pt->window_size = wsize;
+	fwrite( pt, sizeof(GZ_POINT), 1, pgz->index_out );
+	fwrite( window, GZ_WINDOW_SIZE, 1, pgz->index_out );
+}
+
+// write the header and save the index file; the index is dropped if ok is false
+void pgz_finish_index( PGZ_READER *pgz, bool ok ) {
+	GZ_INDEX_HEADER h;
+	memcpy( h.magic, GZ_INDEX_MAGIC, 8 );
+	h.file_size  = pgz->size;
+	h.file_mtime = pgz->file_mtime;
+	h.npoint     = pgz->npoint;
+	fseek( pgz->index_out, 0, SEEK_SET );
+	fwrite( &h, sizeof(h), 1, pgz->index_out );
+
+	ok = ok && pgz->npoint!=0 && !ferror(pgz->index_out);
+	ok = (fclose(pgz->index_out)==0) && ok;
+	pgz->index_out = NULL;
+
+	string tmp = string(pgz->index_file) + ".tmp";
+	if( ! ok || rename( tmp.c_str(), pgz->index_file ) != 0 )
+		unlink( tmp.c_str() );
+}
+
+/*
+ * cut the next job starting from scan_pos; the caller must hold the lock
+ * returns false if there is no more data to dispatch
+*/
+bool pgz_cut_job( PGZ_READER *pgz, GZ_JOB *job ) {
+	register const unsigned char *data = pgz->data;
+	register size_t size  = pgz->size;
+	register size_t start = pgz->scan_pos;
+
+	job->status = GZJOB_PENDING;
+	if( pgz->index_fd >= 0 ) {	// cut by the checkpoints
+		if( pgz->next_point == pgz->npoint )
+			return false;
+		register unsigned int k = pgz->next_point ++;
+		job->point = k;
+		job->start = pgz->points[k].in;
+		job->end   = (k+1 == pgz->npoint) ? size : pgz->points[k+1].in;
+		pgz->scan_pos = job->end;
+		return true;
+	}
+
+	// trailing garbage after the last member is ignored, as gzread() does
+	if( ! is_gzip_header( data+start, size-start ) )
+		return false;
+
+	job->start = start;
+	job->point = -1;
+
+	// BGZF blocks
+	register size_t pos = start;
+	while( pos < size && pos-start < PGZ_JOB_SIZE ) {
+		register size_t bs = bgzf_block_size( data+pos, size-pos );
+		if( bs==0 || pos+bs > size )
+			break;
+		pos += bs;
+	}
+
+	if( pos == start ) {	// not BGZF, guess the member boundary
+		size_t limit = size-start > PGZ_MAX_MEMBER ? start+PGZ_MAX_MEMBER : size;
+		size_t small = start + PGZ_JOB_SIZE < limit ? start + PGZ_JOB_SIZE : limit;
+		pos = find_gzip_member( data, size, small, limit );
+		if( pos == limit && limit != size ) {
+			// try a smaller job before giving up
+			register size_t last = limit;
+			register size_t k = find_gzip_member( data, size, start+GZIP_MIN_MEMBER, small );
+			while( k != small ) {
+				last = k;
+				k = find_gzip_member( data, size, k+1, small );
+			}
+			pos = last;
+		}
+		if( pos == limit && limit != size ) {	// a large member, inflate it by the reading thread
+			job->status = GZJOB_SEQUENTIAL;
+			pgz->scan_paused = true;
+			pos = size;
+		}
+	}
+
+	job->end = pos;
+	pgz->scan_pos = pos;
+	return true;
+}
+
+// dispatch jobs until the ring is full; the caller must hold the lock
+void pgz_dispatch( PGZ_READER *pgz ) {
+	bool dispatched = false;
+	while( ! pgz->scan_paused && pgz->scan_pos < pgz->size &&
+			pgz->next_dispatch - pgz->next_consume < pgz->njob ) {
+		if( ! pgz_cut_job( pgz, pgz->jobs + pgz->next_dispatch % pgz->njob ) ) {
+			pgz->scan_pos = pgz->size;
+			break;
+		}
+		++ pgz->next_dispatch;
+		dispatched = true;
+	}
+	if( dispatched )
+		pgz->job_ready.notify_all();
+}
+
+/*
+ * inflate all the members in a job; the job fails if the last member does not end exactly
+ * at the end of the job
+*/
+bool pgz_inflate_job( z_stream *zs, const unsigned char *data, GZ_JOB *job ) {
+	register size_t pos = job->start;
+	job->out_size = 0;
+
+	while( pos < job->end ) {
+		inflateReset( zs );
+		zs->next_in  = (Bytef *) data + pos;
+		zs->avail_in = job->end - pos;
+
+		while( true ) {
+			if( job->out_size == job->out_capacity ) {
+				job->out_capacity = job->out_capacity ? job->out_capacity<<1 : (job->end-job->start)<<2;
+				job->out = (char *) realloc( job->out, job->out_capacity );
+			}
+			zs->next_out  = (Bytef *) job->out + job->out_size;
+			zs->avail_out = job->out_capacity - job->out_size;
+			int ret = inflate( zs, Z_NO_FLUSH );
+			job->out_size = job->out_capacity - zs->avail_out;
+
+			if( ret == Z_STREAM_END )
+				break;
+			if( ret != Z_OK && !(ret==Z_BUF_ERROR && zs->avail_out==0) )
+				return false;
+		}
+		pos = job->end - zs->avail_in;
+	}
+	return true;
+}
+
+/*
+ * inflate the raw deflate data from a checkpoint to the next one; the size of the output is
+ * recorded in the index, except for the last checkpoint, which goes to the end of the member
+*/
+bool pgz_inflate_point( PGZ_READER *pgz, z_stream *zs, unsigned char *window, GZ_JOB *job ) {
+	const GZ_POINT *pt = pgz->points + job->point;
+	if( pread(pgz->index_fd, window, GZ_WINDOW_SIZE, pgz_point_offset(job->point)+sizeof(GZ_POINT)) != GZ_WINDOW_SIZE )
+		return false;
+
+	inflateReset( zs );
+	if( pt->bits )
+		inflatePrime( zs, pt->bits, pgz->data[pt->in-1] >> (8-pt->bits) );
+	if( pt->window_size )
+		inflateSetDictionary( zs, window, pt->window_size );
+
+	bool last = ( job->point+1 == pgz->npoint );
+	register size_t expected = last ? 0 : pt[1].out - pt->out;
+	register size_t left = pgz->size - pt->in;
+	zs->next_in  = (Bytef *) pgz->data + pt->in;
+	zs->avail_in = left > UINT_MAX ? UINT_MAX : left;
+	job->out_size = 0;
+	if( !last && job->out_capacity < expected ) {
+		job->out_capacity = expected;
+		job->out = (char *) realloc( job->out, job->out_capacity );
+	}
+
+	while( true ) {
+		if( last && job->out_size == job->out_capacity ) {
+			job->out_capacity = job->out_capacity ? job->out_capacity<<1 : GZ_INDEX_SPAN<<1;
+			job->out = (char *) realloc( job->out, job->out_capacity );
+		}
+		zs->next_out  = (Bytef *) job->out + job->out_size;
+		zs->avail_out = ( last ? job->out_capacity : expected ) - job->out_size;
+		int ret = inflate( zs, Z_NO_FLUSH );
+		job->out_size = ( last ? job->out_capacity : expected ) - zs->avail_out;
+
+		if( !last && job->out_size == expected )
+			return true;
+		if( ret == Z_STREAM_END )
+			return last;
+		if( ret != Z_OK && !(ret==Z_BUF_ERROR && zs->avail_out==0) )
+			return false;
+	}
+}
+
+void pgz_worker( PGZ_READER *pgz ) {
+	z_stream zs, raw;
+	memset( &zs, 0, sizeof(z_stream) );
+	inflateInit2( &zs, 15+16 );
+	memset( &raw, 0, sizeof(z_stream) );
+	inflateInit2( &raw, -15 );
+	unsigned char *window = (unsigned char *) malloc( GZ_WINDOW_SIZE );
+
+	unique_lock<mutex> lock( pgz->lock );
+	while( true ) {
+		pgz->job_ready.wait( lock, [pgz]{ return pgz->quit || pgz->next_work < pgz->next_dispatch; } );
+		if( pgz->quit )
+			break;
+
+		GZ_JOB *job = pgz->jobs + pgz->next_work % pgz->njob;
+		++ pgz->next_work;
+		if( job->status == GZJOB_SEQUENTIAL )
+			continue;
+
+		job->status = GZJOB_RUNNING;
+		lock.unlock();
+		bool ok;
+		if( job->point >= 0 )
+			ok = pgz_inflate_point( pgz, &raw, window, job );
+		else
+			ok = pgz_inflate_job( &zs, pgz->data, job );
+		lock.lock();
+		job->status = ok ? GZJOB_DONE : GZJOB_FAILED;
+		pgz->job_done.notify_all();
+	}
+
+	free( window );
+	inflateEnd( &raw );
+	inflateEnd( &zs );
+}
+
+/*
+ * map the file and start the decompression threads; if file is not NULL, the checkpoint index
+ * of this file is used (or built if there is no valid one)
+ * returns NULL if the file could not be mapped or it is not Gzipped, and the caller
+ * should use gzread() instead
+*/
+PGZ_READER * pgz_open( int fd, unsigned int nthread, const char *file ) {
+	struct stat st;
+	if( fstat(fd, &st)!=0 || !S_ISREG(st.st_mode) || st.st_size < GZIP_MIN_MEMBER )
+		return NULL;
+
+	void *map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	if( map == MAP_FAILED )
+		return NULL;
+	if( ! is_gzip_header( (const unsigned char *)map, st.st_size ) ) {
+		munmap( map, st.st_size );
+		return NULL;
+	}
+	madvise( map, st.st_size, MADV_SEQUENTIAL );
+
+	PGZ_READER *pgz = new PGZ_READER;
+	pgz->data = (const unsigned char *) map;
+	pgz->size = st.st_size;
+
+	pgz->njob = PGZ_JOBS_PER_THREAD * nthread;
+	pgz->jobs = new GZ_JOB[ pgz->njob ];
+	for( unsigned int i=0; i!=pgz->njob; ++i ) {
+		pgz->jobs[i].out = NULL;
+		pgz->jobs[i].out_size = 0;
+		pgz->jobs[i].out_capacity = 0;
+	}
+	pgz->next_dispatch = 0;
+	pgz->next_work     = 0;
+	pgz->next_consume  = 0;
+	pgz->scan_pos      = 0;
+	pgz->scan_paused   = false;
+
+	pgz->sequential = false;
+	pgz->seq_pos    = 0;
+	memset( &pgz->zs, 0, sizeof(z_stream) );
+	inflateInit2( &pgz->zs, 15+16 );
+
+	pgz->current    = NULL;
+	pgz->out_offset = 0;
+	pgz->quit       = false;
+
+	pgz->index_file = NULL;
+	pgz->index_fd   = -1;
+	pgz->index_out  = NULL;
+	pgz->file_mtime = st.st_mtime;
+	pgz->points     = NULL;
+	pgz->npoint     = 0;
+	pgz->point_capacity = 0;
+	pgz->next_point = 0;
+	if( file != NULL ) {
+		pgz->index_file = (char *) malloc( strlen(file) + sizeof(GZ_INDEX_SUFFIX) );
+		strcpy( pgz->index_file, file );
+		strcat( pgz->index_file, GZ_INDEX_SUFFIX );
+		pgz_load_index( pgz );
+	}
+
+	pgz->nthread = nthread;
+	pgz->workers = new thread[ nthread ];
+	for( unsigned int i=0; i!=nthread; ++i )
+		pgz->workers[i] = thread( pgz_worker, pgz );
+
+	unique_lock<mutex> lock( pgz->lock );
+	pgz_dispatch( pgz );
+
+	return pgz;
+}
+
+void pgz_close( PGZ_READER *pgz ) {
+	{
+		lock_guard<mutex> lock( pgz->lock );
+		pgz->quit = true;
+	}
+	pgz->job_ready.notify_all();
+	for( unsigned int i=0; i!=pgz->nthread; ++i )
+		pgz->workers[i].join();
+	delete [] pgz->workers;
+
+	for( unsigned int i=0; i!=pgz->njob; ++i )
+		free( pgz->jobs[i].out );
+	delete [] pgz->jobs;
+
+	if( pgz->index_out != NULL )	// not finished
+		pgz_finish_index( pgz, false );
+	if( pgz->index_fd >= 0 )
+		close( pgz->index_fd );
+	free( pgz->points );
+	free( pgz->index_file );
+
+	inflateEnd( &pgz->zs );
+	munmap( (void *)pgz->data, pgz->size );
+	delete pgz;
+}
+
+// switch to the sequential mode, i.e., the reading thread inflates the member at pos
+void pgz_start_sequential( PGZ_READER *pgz, size_t pos ) {
+	pgz->sequential = true;
+	pgz->seq_pos    = pos;
+	inflateReset( &pgz->zs );
+	if( pos==0 && pgz->index_file!=NULL && pgz->index_fd<0 )
+		pgz_start_index( pgz );
+}
+
+/*
+ * inflate the current member by the reading thread
+ * returns the number of bytes written to buf, or -1 if the data is corrupted
+*/
+long pgz_read_sequential( PGZ_READER *pgz, char *buf, size_t len ) {
+	register size_t left = pgz->size - pgz->seq_pos;
+	pgz->zs.next_in   = (Bytef *) pgz->data + pgz->seq_pos;
+	pgz->zs.avail_in  = left > UINT_MAX ? UINT_MAX : left;
+	pgz->zs.next_out  = (Bytef *) buf;
+	pgz->zs.avail_out = len > UINT_MAX ? UINT_MAX : len;
+
+	uInt avail_in = pgz->zs.avail_in;
+	uInt avail_out = pgz->zs.avail_out;
+	// Z_BLOCK stops at the end of each deflate block, where a checkpoint could be recorded
+	int ret = inflate( &pgz->zs, pgz->index_out ? Z_BLOCK : Z_NO_FLUSH );
+	pgz->seq_pos += avail_in - pgz->zs.avail_in;
+	long n = avail_out - pgz->zs.avail_out;
+
+	if( pgz->index_out!=NULL && (pgz->zs.data_type & 128) && !(pgz->zs.data_type & 64) &&
+			(pgz->npoint==0 || pgz->zs.total_out - pgz->points[pgz->npoint-1].out >= GZ_INDEX_SPAN) )
+		pgz_add_point( pgz );
+
+	if( ret == Z_STREAM_END ) {	// continue with the parallel mode from the next member
+		if( pgz->index_out != NULL ) {	// the index is only useful for single-member files
+			pgz_finish_index( pgz, pgz->seq_pos==pgz->size ||
+						! is_gzip_header( pgz->data+pgz->seq_pos, pgz->size-pgz->seq_pos ) );
+		}
+		pgz->sequential = false;
+		unique_lock<mutex> lock( pgz->lock );
+		pgz->scan_pos = pgz->seq_pos;
+		pgz->scan_paused = false;
+		pgz_dispatch( pgz );
+	} else if( ret==Z_OK || (ret==Z_BUF_ERROR && pgz->seq_pos!=pgz->size) ) {
+		// more data to go
+	} else {
+		if( pgz->index_out != NULL )
+			pgz_finish_index( pgz, false );
+		if( pgz->seq_pos == pgz->size )
+			cerr << "\033[1;31mError: unexpected end of Gzipped file!\033[0m\n";
+		else
+			cerr << "\033[1;31mError: the Gzipped file is corrupted!\033[0m\n";
+		return -1;
+	}
+	return n;
+}
+
+/*
+ * read up to len bytes of decompressed data into buf
+ * returns 0 at the end of the file, or -1 on error
+*/
+long pgz_read( PGZ_READER *pgz, char *buf, size_t len ) {
+	while( true ) {
+		if( pgz->current != NULL ) {
+			GZ_JOB *job = pgz->current;
+			register size_t n = job->out_size - pgz->out_offset;
+			if( n > len )
+				n = len;
+			memcpy( buf, job->out + pgz->out_offset, n );
+			pgz->out_offset += n;
+
+			if( pgz->out_offset == job->out_size ) {	// release the job
+				unique_lock<mutex> lock( pgz->lock );
+				pgz->current = NULL;
+				++ pgz->next_consume;
+				pgz_dispatch( pgz );
+			}
+			if( n != 0 )
+				return n;
+			continue;
+		}
+
+		if( pgz->sequential ) {
+			long n = pgz_read_sequential( pgz, buf, len );
+			if( n != 0 )
+				return n;
+			continue;
+		}
+
+		unique_lock<mutex> lock( pgz->lock );
+		pgz_dispatch( pgz );
+		if( pgz->next_consume == pgz->next_dispatch )	// all done
+			return 0;
+
+		GZ_JOB *job = pgz->jobs + pgz->next_consume % pgz->njob;
+		if( job->status == GZJOB_SEQUENTIAL ) {
+			++ pgz->next_consume;
+			pgz_start_sequential( pgz, job->start );
+			continue;
+		}
+
+		pgz->job_done.wait( lock, [job]{ return job->status==GZJOB_DONE || job->status==GZJOB_FAILED; } );
+		if( job->status == GZJOB_DONE ) {
+			pgz->current = job;
+			pgz->out_offset = 0;
+			continue;
+		}
+
+		if( job->point >= 0 ) {
+			cerr << "\033[1;31mError: the Gzipped file is corrupted!\033[0m\n";
+			return -1;
+		}
+
+		// the job end is not a real member boundary: drop all the jobs after it, and inflate
+		// the data from the start of this job by the reading thread
+		pgz->next_work = pgz->next_dispatch;
+		pgz->job_done.wait( lock, [pgz]{
+			for( unsigned long k=pgz->next_consume; k!=pgz->next_dispatch; ++k )
+				if( pgz->jobs[k % pgz->njob].status == GZJOB_RUNNING )
+					return false;
+			return true;
+		} );
+		pgz->next_dispatch = pgz->next_consume;
+		pgz->next_work     = pgz->next_consume;
+		pgz->scan_paused   = true;
+		pgz_start_sequential( pgz, job->start );
+	}
+}
+
+#endif
@@ -0,0 +1,213 @@
+/**
+ * Author: Ktrim contributors
+ * Date: Oct 2026
+ * Gzipped output: each working thread compresses its own write buffer
+ * This program is part of the Ktrim package
+**/
+
+#ifndef _KTRIM_GZ_WRITER_
+#define _KTRIM_GZ_WRITER_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <zlib.h>
+#include "common.h"
+
+using namespace std;
+
+/*
+ * the output is a concatenation of independent gzip members (which is a valid Gzip file);
+ * a new member is started every GZ_MEMBER_READS input reads of a batch, and the reads of a
+ * batch are assigned to the working threads in pieces of READS_PER_PIECE reads (see batch_npiece in
+ * util.h), therefore the output is the same no matter how many threads are used
+ *
+ * in BGZF mode (update in v1.7), each member is further cut into BGZF blocks of BGZF_BLOCK_DATA
+ * bytes (at most), and the .gzi index (the same format as "bgzip -i") could be written, which
+ * records the compressed and uncompressed offsets of each block
+*/
+
+// size of the buffer to hold the compressed data of size bytes (see deflateBound in zlib)
+unsigned int inline gz_buffer_size( unsigned int size ) {
+	return size + (size >> 8) + 64 * ( GZ_MAX_MEMBERS + 1 );
+}
+
+// size1: size of buffer1 for each thread; has_buffer2: whether buffer2 is used
+void init_gz_wrbuffer( writeBuffer &writebuffer, unsigned int nthread, unsigned int size1, bool has_buffer2, bool bgzf ) {
+	writebuffer.gzbuffer1 = new char * [ nthread ];
+	writebuffer.gzbuffer2 = new char * [ nthread ];
+	writebuffer.gz1stored = new unsigned int [ nthread ];
+	writebuffer.gz2stored = new unsigned int [ nthread ];
+	writebuffer.gz1capacity = new unsigned int [ nthread ];
+	writebuffer.gz2capacity = new unsigned int [ nthread ];
+	writebuffer.mark1 = new unsigned int * [ nthread ];
+	writebuffer.mark2 = new unsigned int * [ nthread ];
+	writebuffer.nmark = new unsigned int [ nthread ];
+	writebuffer.zs    = new z_stream [ nthread ];
+	writebuffer.bgzf  = bgzf;
+	writebuffer.coffset[0] = writebuffer.coffset[1] = 0;
+	writebuffer.uoffset[0] = writebuffer.uoffset[1] = 0;
+
+	for( unsigned int i=0; i!=nthread; ++i ) {
+		writebuffer.gzbuffer1[i] = new char[ gz_buffer_size(size1) ];
+		writebuffer.gzbuffer2[i] = has_buffer2 ? new char[ gz_buffer_size(size1) ] : NULL;
+		writebuffer.gz1stored[i] = 0;
+		writebuffer.gz2stored[i] = 0;
+		writebuffer.gz1capacity[i] = gz_buffer_size(size1);
+		writebuffer.gz2capacity[i] = has_buffer2 ? gz_buffer_size(size1) : 0;
+		writebuffer.mark1[i] = new unsigned int[ GZ_MAX_MEMBERS ];
+		writebuffer.mark2[i] = new unsigned int[ GZ_MAX_MEMBERS ];
+		writebuffer.nmark[i] = 0;
+
+		memset( writebuffer.zs+i, 0, sizeof(z_stream) );
+		deflateInit2( writebuffer.zs+i, GZ_OUTPUT_LEVEL, Z_DEFLATED, bgzf ? -15 : 15+16, 8, Z_DEFAULT_STRATEGY );
+	}
+}
+
+void free_gz_wrbuffer( writeBuffer &writebuffer, unsigned int nthread ) {
+	for( unsigned int i=0; i!=nthread; ++i ) {
+		delete [] writebuffer.gzbuffer1[i];
+		delete [] writebuffer.gzbuffer2[i];
+		delete [] writebuffer.mark1[i];
+		delete [] writebuffer.mark2[i];
+		deflateEnd( writebuffer.zs+i );
+	}
+	delete [] writebuffer.gzbuffer1;
+	delete [] writebuffer.gzbuffer2;
+	delete [] writebuffer.gz1stored;
+	delete [] writebuffer.gz2stored;
+	delete [] writebuffer.gz1capacity;
+	delete [] writebuffer.gz2capacity;
+	delete [] writebuffer.mark1;
+	delete [] writebuffer.mark2;
+	delete [] writebuffer.nmark;
+	delete [] writebuffer.zs;
+}
+
+// start a new gzip member from the current position of the write buffers
+void inline gz_mark_member( writeBuffer *writebuffer, unsigned int tn, bool has_buffer2 ) {
+	register unsigned int k = writebuffer->nmark[tn] ++;
+	writebuffer->mark1[tn][k] = writebuffer->b1stored[tn];
+	if( has_buffer2 )
+		writebuffer->mark2[tn][k] = writebuffer->b2stored[tn];
+}
+
+void inline write_le32( char *p, uint32_t v ) {
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = v >> 24;
+}
+
+/*
+ * compress data[0, size) into out as a BGZF block, size should be no more than BGZF_BLOCK_DATA
+ * zs must be a raw deflate stream; returns the size of the block
+*/
+unsigned int bgzf_compress_block( z_stream *zs, const char *data, unsigned int size, char *out ) {
+	deflateReset( zs );
+	zs->next_in   = (Bytef *) data;
+	zs->avail_in  = size;
+	zs->next_out  = (Bytef *) out + BGZF_HEADER_SIZE;
+	zs->avail_out = 0x10000 - BGZF_HEADER_SIZE - 8;	// enough for BGZF_BLOCK_DATA bytes of any data
+	deflate( zs, Z_FINISH );
+
+	register unsigned int bsize = BGZF_HEADER_SIZE + zs->total_out + 8;
+	memcpy( out, BGZF_HEADER, BGZF_HEADER_SIZE );
+	out[16] = (bsize-1) & 0xff;
+	out[17] = (bsize-1) >> 8;
+	write_le32( out + bsize - 8, crc32( 0, (const Bytef *) data, size ) );
+	write_le32( out + bsize - 4, size );
+	return bsize;
+}
+
+/*
+ * compress buf[0, size) into out as gzip members, which start at the marks; empty members are skipped
+ * returns the size of the compressed data
+*/
+unsigned int gz_compress_members( z_stream *zs, const char *buf, unsigned int size,
+									const unsigned int *mark, unsigned int nmark, char *out, bool bgzf ) {
+	register unsigned int stored = 0;
+	register unsigned int from = 0;
+	register unsigned int capacity = gz_buffer_size( size );
+	for( unsigned int i=0; i<=nmark; ++i ) {
+		register unsigned int to = (i==nmark) ? size : mark[i];
+		if( to == from )
+			continue;
+
+		if( bgzf ) {
+			for( ; from != to; ) {
+				register unsigned int n = to - from;
+				if( n > BGZF_BLOCK_DATA )
+					n = BGZF_BLOCK_DATA;
+				stored += bgzf_compress_block( zs, buf + from, n, out + stored );
+				from += n;
+			}
+			continue;
+		}
+
+		deflateReset( zs );
+		zs->next_in   = (Bytef *) buf + from;
+		zs->avail_in  = to - from;
+		zs->next_out  = (Bytef *) out + stored;
+		zs->avail_out = capacity - stored;
+		deflate( zs, Z_FINISH );	// the output buffer is large enough to finish in 1 call
+		stored = capacity - zs->avail_out;
+		from = to;
+	}
+	return stored;
+}
+
+// make sure that the buffer could hold the compressed data of size bytes
+void inline gz_reserve( char * &buffer, unsigned int &capacity, unsigned int size ) {
+	if( gz_buffer_size(size) > capacity ) {
+		delete [] buffer;
+		capacity = gz_buffer_size(size);
+		buffer = new char[ capacity ];
+	}
+}
+
+// compress the write buffers of thread tn
+void gz_compress_wrbuffer( writeBuffer *writebuffer, unsigned int tn, bool has_buffer2 ) {
+	// the write buffers may have grown (see emit_fastq_record)
+	gz_reserve( writebuffer->gzbuffer1[tn], writebuffer->gz1capacity[tn], writebuffer->b1stored[tn] );
+	if( has_buffer2 )
+		gz_reserve( writebuffer->gzbuffer2[tn], writebuffer->gz2capacity[tn], writebuffer->b2stored[tn] );
+
+	writebuffer->gz1stored[tn] = gz_compress_members( writebuffer->zs+tn, writebuffer->buffer1[tn], writebuffer->b1stored[tn],
+									writebuffer->mark1[tn], writebuffer->nmark[tn], writebuffer->gzbuffer1[tn], writebuffer->bgzf );
+	if( has_buffer2 )
+		writebuffer->gz2stored[tn] = gz_compress_members( writebuffer->zs+tn, writebuffer->buffer2[tn], writebuffer->b2stored[tn],
+									writebuffer->mark2[tn], writebuffer->nmark[tn], writebuffer->gzbuffer2[tn], writebuffer->bgzf );
+}
+
+/*
+ * append the BGZF blocks in buf[0, size) to the .gzi index; for each block, the offsets of its
+ * end (i.e., the start of the next block) are written, the same as htslib
+*/
+bool bgzf_write_index( FILE *fgzi, const char *buf, unsigned int size, uint64_t &coffset, uint64_t &uoffset ) {
+	register const unsigned char *p = (const unsigned char *) buf;
+	register const unsigned char *e = p + size;
+	while( p < e ) {
+		register unsigned int bsize = (p[16] | (p[17]<<8)) + 1;
+		register const unsigned char *q = p + bsize - 4;
+		coffset += bsize;
+		uoffset += q[0] | (q[1]<<8) | (q[2]<<16) | ((uint32_t)q[3]<<24);
+		if( fwrite( &coffset, sizeof(uint64_t), 1, fgzi ) != 1 || fwrite( &uoffset, sizeof(uint64_t), 1, fgzi ) != 1 )
+			return false;
+		p += bsize;
+	}
+	return true;
+}
+
+// write the EOF marker of BGZF files and the number of entries of the .gzi index
+void bgzf_close( FILE *fout, FILE *fgzi ) {
+	fwrite( BGZF_EOF, sizeof(BGZF_EOF), 1, fout );
+	if( fgzi != NULL ) {
+		uint64_t n = ( ftell(fgzi) - sizeof(uint64_t) ) / (sizeof(uint64_t) << 1);
+		fseek( fgzi, 0, SEEK_SET );
+		fwrite( &n, sizeof(uint64_t), 1, fgzi );
+		fclose( fgzi );
+	}
+}
+
+#endif
@@ -19,34 +19,49 @@
 #include "param_handler.h"
 #include "pe_handler.h"
 #include "se_handler.h"
+#include "sample_handler.h"
+#include "server.h"
 
 using namespace std;
 
-int main( int argc, char *argv[] ) {
-	// process the command line parameters
-	static ktrim_param kp;
-	init_param( kp );
-	int retValue = process_cmd_param( argc, argv, kp );
-	if( retValue == 100 )	// help or version
-		return 0;
-	else if( retValue != 0 )
-		return retValue;
+// trim the input files with the loaded parameters, and close the output files
+int trim_files( const ktrim_param &kp ) {
+	if( kp.samplelist != NULL )	// update in v1.7: multi-sample mode
+		return process_samples( kp );
 
+	int retValue;
 	if( kp.paired_end_data ) {  // single-end data
 		if( kp.thread == 1 )
 			retValue = process_single_thread_PE_C( kp );
 		else if( kp.thread == 2 )
 			retValue = process_two_thread_PE_C( kp );
 		else
-			retValue = process_multi_thread_PE_C( kp );
+			retValue = process_multi_thread_PE_C( kp, &kp, 1 );
 	} else {
 		if( kp.thread == 1 )
 			retValue = process_single_thread_SE_C( kp );
 		else
-			retValue = process_multi_thread_SE_C( kp );
+			retValue = process_multi_thread_SE_C( kp, &kp, 1 );
 	}
 
 	close_files( kp );
 	return retValue;
 }
 
+int main( int argc, char *argv[] ) {
+	// process the command line parameters
+	static ktrim_param kp;
+	init_param( kp );
+	int retValue = process_cmd_param( argc, argv, kp );
+	if( retValue == 100 )	// help or version
+		return 0;
+	else if( retValue != 0 )
+		return retValue;
+
+	if( kp.server_socket != NULL )	// update in v1.7: server mode
+		return run_server( kp.server_socket );
+	if( kp.connect_socket != NULL )
+		return run_client( kp.connect_socket, argc, argv );
+
+	return trim_files( kp );
+}
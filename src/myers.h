@@ -0,0 +1,107 @@
+/**
+ * Author: Ktrim contributors
+ * Date: Oct 2026
+ * Bit-parallel edit distance (Myers' algorithm) between the adapters and the reads ('--indel')
+ * This program is part of the Ktrim package
+**/
+
+/*
+ * update in v1.7: the seeds are checked by the number of mismatches, so adapters with indels (e.g.,
+ * homopolymer errors of Ion Torrent data) are missed; with '--indel', a seed failing the mismatch check
+ * is checked again by the edit distance between the adapter and the read from the seed on, which is
+ * computed by Myers' bit-vector algorithm (1 column of the DP matrix per base of the read)
+ * reads without seeds exit as fast as before, and most real adapters pass the mismatch check, so the
+ * edit distance is only computed for a few seeds
+ *
+ * the alignment starts at the seed and the 1st base of the adapter, and ends at the end of the adapter
+ * (the rest of the read is free) or at the end of the read (the rest of the adapter is free); the
+ * edit distance allowed is the same as the mismatches (kp.max_mismatch)
+*/
+
+// bits 1-2 of the ASCII code differ among A, C, T and G; other bases (e.g., N) match nothing
+uint64_t inline myers_eq( char c, const uint64_t *peq ) {
+	register unsigned int code = (c >> 1) & 3;
+	return ( c == "ACTG"[code] ) ? peq[code] : 0;
+}
+
+const unsigned int MYERS_CUTOFF_STEP = 4;
+
+// the minimum of D[r][col] for the rows r in [col-max, col+max] (and [0, m]) of the column
+unsigned int inline myers_column_min( uint64_t Pv, uint64_t Mv, unsigned int col, unsigned int m, unsigned int max ) {
+	register unsigned int r   = ( col > max ) ? col - max : 0;
+	register unsigned int end = ( col + max < m ) ? col + max : m;
+	register uint64_t mask;
+	register unsigned int d, low = col + max + 1;
+	for( ; r<=end; ++r ) {	// D[r][col] = col + (vertical deltas of rows 1..r)
+		mask = ( r == 64 ) ? ~(uint64_t)0 : ((uint64_t)1 << r) - 1;
+		d = col + __builtin_popcountll( Pv & mask ) - __builtin_popcountll( Mv & mask );
+		if( d < low )
+			low = d;
+	}
+	return low;
+}
+
+/*
+ * edit distance between the adapter (m bases, 0 < m <= 64) and p[0, n), anchored at both starts
+ * the values above max are not exact (only compared with max)
+*/
+unsigned int myers_distance( const char *p, unsigned int n, const uint64_t *peq, unsigned int m, unsigned int max ) {
+	register uint64_t Pv = ~(uint64_t)0, Mv = 0;	// vertical deltas of the column, D[i][0] = i
+	register uint64_t Eq, Xv, Xh, Ph, Mh;
+	register const uint64_t last = (uint64_t)1 << (m-1);
+	register unsigned int score = m;	// D[m][j]
+	register unsigned int best  = ( n < m ) ? n : m;	// D[0][n] or D[m][0]
+	register unsigned int ncol = ( n < m + max ) ? n : m + max;	// D[m][j] > max beyond that
+	register unsigned int j;
+
+	for( j=0; j!=ncol; ++j ) {
+		Eq = myers_eq( p[j], peq );
+		Xv = Eq | Mv;
+		Xh = (((Eq & Pv) + Pv) ^ Pv) | Eq;
+		Ph = Mv | ~(Xh | Pv);
+		Mh = Pv & Xh;
+		if( Ph & last )
+			++ score;
+		else if( Mh & last )
+			-- score;
+		Ph = (Ph << 1) | 1;		// anchored start: D[0][j] = j
+		Mh <<= 1;
+		Pv = Mh | ~(Xv | Ph);
+		Mv = Ph & Xv;
+
+		if( score < best )		// the adapter ends at p[j]
+			best = score;
+
+		// the minimum of a column never decreases, so stop once the cells (within the band of max,
+		// i.e., rows [j+1-max, j+1+max]) are all above max; checked every MYERS_CUTOFF_STEP columns
+		if( (j & (MYERS_CUTOFF_STEP-1)) == MYERS_CUTOFF_STEP-1 && best > max && myers_column_min( Pv, Mv, j+1, m, max ) > max )
+			return best;
+	}
+
+	if( ncol == n ) {	// the read ends within the adapter: D[i][n] = n + (vertical deltas of rows 1..i)
+		register unsigned int d = n;
+		for( register unsigned int i=0; i!=m; ++i ) {
+			d += ((Pv >> i) & 1) - ((Mv >> i) & 1);
+			if( d < best )
+				best = d;
+		}
+	}
+	return best;
+}
+
+bool check_edit_distance_SE( const CSEREAD *read, unsigned int pos, const ktrim_param &kp ) {
+	register unsigned int len = read->size - pos;
+	if( len > kp.adapter_len )
+		len = kp.adapter_len;
+	register unsigned int max_mismatch_dynamic = kp.max_mismatch[len];
+	return myers_distance( read->seq+pos, read->size-pos, kp.adapter_peq1, kp.adapter_len, max_mismatch_dynamic ) <= max_mismatch_dynamic;
+}
+
+bool check_edit_distance_PE( const CPEREAD *read, unsigned int pos, const ktrim_param &kp ) {
+	register unsigned int len = read->size - pos;
+	if( len > kp.adapter_len )
+		len = kp.adapter_len;
+	register unsigned int max_mismatch_dynamic = kp.max_mismatch[len];
+	return myers_distance( read->seq1+pos, read->size-pos, kp.adapter_peq1, kp.adapter_len, max_mismatch_dynamic ) <= max_mismatch_dynamic &&
+		   myers_distance( read->seq2+pos, read->size-pos, kp.adapter_peq2, kp.adapter_len, max_mismatch_dynamic ) <= max_mismatch_dynamic;
+}
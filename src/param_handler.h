@@ -15,6 +15,9 @@
 #include <getopt.h>
 #include <omp.h>
 #include "common.h"
+#include "util.h"
+#include "gz_writer.h"
+#include "simd.h"
 
 using namespace std;
 
@@ -30,6 +33,11 @@ void init_param( ktrim_param &kp ) {
 	kp.FASTQ2 = NULL;
 	kp.FASTQU = NULL;
 	kp.outpre = NULL;
+	kp.samplelist = NULL;
+	kp.filelist = NULL;
+	kp.server_socket  = NULL;
+	kp.connect_socket = NULL;
+	kp.max_memory = 0;
 
 	kp.thread = 6;
 	kp.min_length = 36;
@@ -50,9 +58,32 @@ void init_param( ktrim_param &kp ) {
 	kp.adapter_index3 = NULL;
 
 	kp.write2stdout = false;
+	kp.gzip_output = false;
+	kp.bgzf_output = false;
+	kp.write_gzi   = false;
+	kp.use_writev  = false;
+	kp.fgzi1 = NULL;
+	kp.fgzi2 = NULL;
 	kp.outputReadWithAdaptorOnly = false;
+	kp.use_mmap = false;
+	kp.gz_index = false;
 	kp.use_default_mismatch = true;
 	kp.mismatch_rate = 0.125;
+	kp.use_bitpar = false;
+	kp.use_indel  = false;
+	kp.simd_level = SIMD_LEVEL_AUTO;
+}
+
+// update in v1.7: open the .gzi index for a BGZF output file; the number of entries is written when closing
+// returns NULL if the file could not be opened
+FILE * open_gzi( const string &fileName ) {
+	string gzi = fileName + ".gzi";
+	FILE *fp = fopen( gzi.c_str(), "wb" );
+	if( fp == NULL )
+		return NULL;
+	uint64_t n = 0;
+	fwrite( &n, sizeof(uint64_t), 1, fp );
+	return fp;
 }
 
 // process user-supplied parameters
@@ -60,7 +91,7 @@ int process_cmd_param( int argc, char * argv[], ktrim_param &kp ) {
 	const char * prg = argv[0];
 	int index;
 	int ch;
-	while( (ch = getopt(argc, argv, param_list) ) != -1 ) {
+	while( (ch = getopt_long(argc, argv, param_list, long_param_list, NULL) ) != -1 ) {
 		switch( ch ) {
 			case 'f': kp.filelist = optarg; break;
 			case '1': kp.FASTQ1 = optarg; break;
@@ -79,6 +110,32 @@ int process_cmd_param( int argc, char * argv[], ktrim_param &kp ) {
 			case 'm': kp.use_default_mismatch = false; kp.mismatch_rate = atof(optarg); break;
 			case 'c': kp.write2stdout = true; break;
 			case 'R': kp.outputReadWithAdaptorOnly = true; break;
+			case 'z': kp.gzip_output = true; break;
+			case OPT_MMAP: kp.use_mmap = true; break;
+			case OPT_GZ_INDEX: kp.gz_index = true; break;
+			case OPT_BGZF: kp.gzip_output = kp.bgzf_output = true; break;
+			case OPT_GZI : kp.gzip_output = kp.bgzf_output = kp.write_gzi = true; break;
+			case OPT_WRITEV: kp.use_writev = true; break;
+			case OPT_BITPAR: kp.use_bitpar = true; break;
+			case OPT_INDEL : kp.use_indel  = true; break;
+			case OPT_SIMD:
+				kp.simd_level = simd_parse_level( optarg );
+				if( kp.simd_level < 0 ) {
+					cerr << "\033[1;31mError: invalid SIMD level ('" << optarg << "')!\033[0m\n";
+					usage();
+					return 16;
+				}
+				break;
+			case OPT_SAMPLES: kp.samplelist = optarg; break;
+			case OPT_SERVER : kp.server_socket  = optarg; break;
+			case OPT_CONNECT: kp.connect_socket = optarg; break;
+			case OPT_MAX_MEMORY:
+				if( ! parse_memory_size( optarg, kp.max_memory ) ) {
+					cerr << "\033[1;31mError: invalid memory size ('" << optarg << "')!\033[0m\n";
+					usage();
+					return 15;
+				}
+				break;
 
 			case 'h': usage(); return 100;
 			case 'v': cout << VERSION << '\n'; return 100;
@@ -98,8 +155,32 @@ int process_cmd_param( int argc, char * argv[], ktrim_param &kp ) {
 		return 2;
 	}
 
+	// update in v1.7: the server does not need the other options, and the client sends them to the server
+	if( kp.server_socket != NULL || kp.connect_socket != NULL ) {
+		if( kp.server_socket != NULL && kp.connect_socket != NULL ) {
+			cerr << "\033[1;31mError: '--server' and '--connect' could not be used together!\033[0m\n";
+			usage();
+			return 2;
+		}
+		return 0;
+	}
+
 	// check compulsory paramaters
-	if( kp.filelist == NULL ) {
+	if( kp.samplelist != NULL ) {	// update in v1.7: multi-sample mode
+		if( kp.filelist!=NULL || kp.FASTQU!=NULL || kp.FASTQ1!=NULL || kp.FASTQ2!=NULL || kp.outpre!=NULL ) {
+			cerr << "\033[1;31mError: '--samples' is specified but you also set '-f'/'-U'/'-1'/'-2'/'-o'!\033[0m\n";
+			usage();
+			return 2;
+		}
+		if( kp.write2stdout ) {
+			cerr << "\033[1;31mError: '-c' could not be used with '--samples'!\033[0m\n";
+			usage();
+			return 2;
+		}
+		register int retValue = loadSampleList( kp );
+		if( retValue != 0 )
+			return retValue;
+	} else if( kp.filelist == NULL ) {
 		if( kp.FASTQU != NULL ) {   // single-end
 			if( kp.FASTQ1!=NULL || kp.FASTQ2!=NULL ) {
 				cerr << "\033[1;31mError: '-U' is specified but you also set '-1'/'-2'!\033[0m\n";
@@ -130,10 +211,12 @@ int process_cmd_param( int argc, char * argv[], ktrim_param &kp ) {
 			usage();
 			return 2;
 		}
-		loadFQFileNames( kp );
+		register int retValue = loadFQFileNames( kp );
+		if( retValue != 0 )
+			return retValue;
 	}
 
-	if( kp.outpre == NULL ) {
+	if( kp.outpre == NULL && kp.samplelist == NULL ) {
 		cerr << "\033[1;31mError: No output file specified ('-o' not set)!\033[0m\n";
 		usage();
 		return 3;
@@ -143,11 +226,12 @@ int process_cmd_param( int argc, char * argv[], ktrim_param &kp ) {
 	if( kp.thread == 0 ) {
 //		cerr << "Warning: thread is set to 0! I will use all threads (atmost 8) instead.\n";
 		kp.thread = omp_get_max_threads();
-		if( kp.thread > 8 )
+		// update in v1.7: in split mode ('--mmap'), the input is parsed by all the threads (see fq_split.h)
+		if( kp.thread > 8 && ! kp.use_mmap )
 			kp.thread = 8;
 	}
-	if( kp.thread > 8 ) {
-		cerr << "Warning: we strongly discourage the usage of more than 8 threads.\n";
+	if( kp.thread > 8 && ! kp.use_mmap ) {
+		cerr << "Warning: we strongly discourage the usage of more than 8 threads without '--mmap'.\n";
 	}
 	if( kp.min_length < 10 ) {
 		cerr << "\033[1;31mError: invalid min_length! Must be a larger than 10!\033[0m\n";
@@ -255,29 +339,99 @@ int process_cmd_param( int argc, char * argv[], ktrim_param &kp ) {
 		}
 	}
 
+	// update in v1.7: precompute the mismatch thresholds and the bit-planes of the adapters
+	init_mismatch( kp );
+	bitpar_encode_adapter( kp.adapter_r1, kp.adapter_len, kp.adapter_bits1 );
+	bitpar_encode_adapter( kp.adapter_r2, kp.adapter_len, kp.adapter_bits2 );
+	myers_init_adapter( kp.adapter_r1, kp.adapter_len, kp.adapter_peq1 );
+	myers_init_adapter( kp.adapter_r2, kp.adapter_len, kp.adapter_peq2 );
+	if( kp.use_indel && kp.use_bitpar ) {
+		cerr << "\033[1;32mWarning: '--indel' is ignored with '--bitpar'!\033[0m\n";
+		kp.use_indel = false;
+	}
+
+	// update in v1.7: use the best kernels for the CPU, unless the level is forced by '--simd'
+	register int simd_best = simd_detect();
+	if( kp.simd_level == SIMD_LEVEL_AUTO ) {
+		kp.simd_level = simd_best;
+	} else if( kp.simd_level > simd_best ) {
+		cerr << "\033[1;31mError: '--simd " << SIMD_LEVEL_NAME[kp.simd_level] << "' is not supported by this CPU (up to '"
+			 << SIMD_LEVEL_NAME[simd_best] << "')!\033[0m\n";
+		return 16;
+	}
+	simd_select( kp.simd_level );
+
+	// update in v1.7: size the batches and buffers
+	tune_memory( kp );
+
 	// prepare output files
+	if( kp.use_writev && kp.gzip_output ) {
+		cerr << "\033[1;32mWarning: '--writev' is ignored for Gzipped output!\033[0m\n";
+		kp.use_writev = false;
+	}
+	if( kp.write2stdout && kp.write_gzi ) {
+		cerr << "\033[1;32mWarning: '--gzi' is ignored when writing to stdout!\033[0m\n";
+		kp.write_gzi = false;
+	}
+	if( kp.samplelist == NULL )		// the output files of each sample are opened in process_samples
+		return open_output_files( kp );
+
+	return 0;
+}
+
+// close the output files opened so far, if the others could not be opened
+void close_opened_files( ktrim_param &kp ) {
+	if( ! kp.write2stdout ) {
+		if( kp.fout1 != NULL ) fclose( kp.fout1 );
+		if( kp.fout2 != NULL ) fclose( kp.fout2 );
+	}
+	if( kp.fgzi1 != NULL ) fclose( kp.fgzi1 );
+	if( kp.fgzi2 != NULL ) fclose( kp.fgzi2 );
+	kp.fout1 = kp.fout2 = kp.fgzi1 = kp.fgzi2 = NULL;
+}
+
+/*
+ * open the output files and trim.log with prefix kp.outpre
+ * update in v1.7: returns the exit code (0 for success), and nothing is left open on errors
+*/
+int open_output_files( ktrim_param &kp ) {
 	string fileName = kp.outpre;
+	const char *mode = kp.gzip_output ? "wb" : "wt";
+	kp.fout1 = NULL;
+	kp.fout2 = NULL;
+	kp.fgzi1 = NULL;
+	kp.fgzi2 = NULL;
 	if( kp.write2stdout ) {
 		kp.fout1 = stdout;
-		kp.fout2 = NULL;
 	} else {
 		if( kp.paired_end_data ) {
 			fileName += ".read1.fq";
-			kp.fout1 = fopen( fileName.c_str(), "wt" );
-			fileName[ fileName.size()-4 ] = '2';    // read1 -> read2
-			kp.fout2 = fopen( fileName.c_str(), "wt" );
-			if( kp.fout1 == NULL || kp.fout2 == NULL ) {
+			if( kp.gzip_output )
+				fileName += ".gz";
+			kp.fout1 = fopen( fileName.c_str(), mode );
+			fileName[ fileName.size() - (kp.gzip_output ? 7 : 4) ] = '2';    // read1 -> read2
+			kp.fout2 = fopen( fileName.c_str(), mode );
+			if( kp.fout1 != NULL && kp.fout2 != NULL && kp.write_gzi ) {
+				kp.fgzi2 = open_gzi( fileName );
+				fileName[ fileName.size()-7 ] = '1';
+				kp.fgzi1 = open_gzi( fileName );
+			}
+			if( kp.fout1 == NULL || kp.fout2 == NULL || (kp.write_gzi && (kp.fgzi1 == NULL || kp.fgzi2 == NULL)) ) {
 				cerr << "\033[1;31mError: write file failed!\033[0m\n";
-				if( kp.fout1 != NULL )fclose( kp.fout1 );
-				if( kp.fout2 != NULL )fclose( kp.fout2 );
-				exit(103);
+				close_opened_files( kp );
+				return 103;
 			}
 		} else {	// single-end
 			fileName += ".read1.fq";
-			kp.fout1 = fopen( fileName.c_str(), "wt" );
-			if( kp.fout1 == NULL ) {
+			if( kp.gzip_output )
+				fileName += ".gz";
+			kp.fout1 = fopen( fileName.c_str(), mode );
+			if( kp.fout1 != NULL && kp.write_gzi )
+				kp.fgzi1 = open_gzi( fileName );
+			if( kp.fout1 == NULL || (kp.write_gzi && kp.fgzi1 == NULL) ) {
 				cerr << "\033[1;31mError: write file failed!\033[0m\n";
-				exit(103);
+				close_opened_files( kp );
+				return 103;
 			}
 		}
 	}
@@ -287,15 +441,19 @@ int process_cmd_param( int argc, char * argv[], ktrim_param &kp ) {
 	kp.flog = fopen( fileName.c_str(), "wt" );
 	if( kp.flog == NULL ) {
 		cerr << "\033[1;34mError: cannot write log file!\033[0m\n";
-		if( kp.fout1 != NULL )fclose( kp.fout1 );
-		if( kp.fout2 != NULL )fclose( kp.fout2 );
-		exit(105);
+		close_opened_files( kp );
+		return 105;
 	}
-
 	return 0;
 }
 
 void close_files( const ktrim_param &kp ) {
+	if( kp.bgzf_output ) {
+		bgzf_close( kp.fout1, kp.fgzi1 );
+		if( kp.paired_end_data && ! kp.write2stdout )
+			bgzf_close( kp.fout2, kp.fgzi2 );
+	}
+
 	if( ! kp.write2stdout ) {
 		fclose( kp.fout1 );
 
@@ -337,6 +495,9 @@ cerr << "\n\033[1;34mUsage: Ktrim [options] -f <fq.list> {-1/-U <Read1.fq> [-2 R
 	 << "  -c                Write the trimming results to stdout (default: not set)\n"
      << "                    Note that the interleaved fastq format will be used for paired-end data.\n"
      << "  -R                Only output reads with adapter (default: not set)\n"
+     << "  -z                Write Gzip-compressed output (.fq.gz; default: not set)\n"
+     << "  --bgzf            Write BGZF-compressed output (.fq.gz; default: not set)\n"
+     << "  --gzi             Write BGZF-compressed output and its index (.fq.gz.gzi; default: not set)\n"
 	 << "  -s size           Minimum read size to be kept after trimming (default: 36; must be larger than 10)\n\n"
 
 	 << "  -t threads        Specify how many threads should be used (default: 6)\n"
@@ -357,6 +518,32 @@ cerr << "\n\033[1;34mUsage: Ktrim [options] -f <fq.list> {-1/-U <Read1.fq> [-2 R
 	 << "  -m proportion     Set the proportion of mismatches allowed during index and sequence comparison\n"
 	 << "                    Default: 0.125 (i.e., 1/8 of compared base pairs)\n"
 	 << "                    Please use this option with caution as it affects the accuracy a lot\n\n"
+	 << "  --bitpar          Check the adapters at every position with a bit-parallel matcher instead of\n"
+	 << "                    the exact seeds, which also finds adapters with errors in the first 3 bases\n"
+	 << "                    (default: not set)\n"
+	 << "  --indel           Also allow insertions and deletions in the adapters (e.g., homopolymer errors),\n"
+	 << "                    i.e., check the edit distance of the seeds (default: not set)\n"
+	 << "  --simd level      Force the instruction set of the kernels for benchmarking: scalar, sse2,\n"
+	 << "                    avx2 or avx512 (default: the best one supported by the CPU)\n\n"
+
+	 << "  --mmap            Map plain-text input files into memory instead of reading them (default: not set)\n"
+	 << "                    Reads are trimmed in place without copying; recommended for files on local SSDs\n"
+	 << "                    With 3 or more threads, the mapped files are also parsed by all the threads\n\n"
+	 << "  --gz-index        Use checkpoint index to decompress single-member Gzip files in parallel\n"
+	 << "                    The index is built in the first run and saved as FILE.gz.ktidx (default: not set)\n\n"
+	 << "  --writev          Write plain-text output with writev() straight from the loaded reads\n"
+	 << "                    instead of copying them into the output buffers (default: not set)\n\n"
+	 << "  --max-memory size Limit the memory used for the batches and buffers (e.g., 2G or 800M; default: no limit)\n"
+	 << "                    Smaller batches are used to fit the limit, which may slow down the trimming\n\n"
+	 << "  --samples list    Trim multiple samples in one run, instead of '-f'/'-1'/'-2'/'-U'/'-o'\n"
+	 << "                    Each line of the list is 'out.prefix R1.fq[.gz] [R2.fq[.gz]]', and each sample\n"
+	 << "                    has its own output files and trim.log\n\n"
+
+	 << "  --server socket   Run as a server that trims the jobs sent to the Unix domain socket one by one\n"
+	 << "                    The OpenMP threads are reused between the jobs\n"
+	 << "  --connect socket  Send the job (i.e., all the other options) to the server and wait for it\n"
+	 << "                    The input and output paths are relative to the current directory, and\n"
+	 << "                    the statistics in trim.log are reported to stderr when the job is done\n\n"
 
 	 << "  -h                Show this help information and quit (exit code=0)\n"
 	 << "  -v                Show the software version and quit (exit code=0)\n\n"
@@ -13,14 +13,15 @@
 #include <memory.h>
 #include <omp.h>
 #include "common.h"
+#include "gz_writer.h"
+#include "fq_writer.h"
+#include "pipeline.h"
+#include "simd.h"
 using namespace std;
 
+// update in v1.7: reads are not null-terminated, so only the size is changed
 void inline CPEREAD_resize( CPEREAD * read, int n ) {
 	read->size = n;
-	read->seq1[  n ] = 0;
-	read->qual1[ n ] = 0;
-	read->seq2[  n ] = 0;
-	read->qual2[ n ] = 0;
 }
 
 bool inline is_revcomp( const char a, const char b ) {
@@ -35,7 +36,9 @@ bool inline is_revcomp( const char a, const char b ) {
 	return true;
 }
 
-void init_kstat_wrbuffer( ktrim_stat &kstat, writeBuffer &writebuffer, unsigned int nthread, bool write2stdout ) {
+// update in v1.7: nslot write buffers of size bytes are used for the ordered output queue (see fq_writer.h)
+void init_kstat_wrbuffer( ktrim_stat &kstat, writeBuffer &writebuffer, unsigned int nthread, unsigned int nslot,
+							unsigned int size, bool write2stdout ) {
 	kstat.dropped	   = new unsigned int [ nthread ];
 	kstat.real_adapter = new unsigned int [ nthread ];
 	kstat.tail_adapter = new unsigned int [ nthread ];
@@ -43,22 +46,29 @@ void init_kstat_wrbuffer( ktrim_stat &kstat, writeBuffer &writebuffer, unsigned
 	kstat.pass         = new unsigned int [ nthread ];
 
 	// buffer for storing the modified reads per thread
-	writebuffer.buffer1  = new char * [ nthread ];
-	writebuffer.buffer2  = new char * [ nthread ];
-	writebuffer.b1stored = new unsigned int	[ nthread ];
-	writebuffer.b2stored = new unsigned int [ nthread ];
-
-	for(unsigned int i=0; i!=nthread; ++i) {
+	writebuffer.buffer1  = new char * [ nslot ];
+	writebuffer.buffer2  = new char * [ nslot ];
+	writebuffer.b1stored = new unsigned int	[ nslot ];
+	writebuffer.b2stored = new unsigned int [ nslot ];
+	writebuffer.b1capacity = new unsigned int [ nslot ];
+	writebuffer.b2capacity = new unsigned int [ nslot ];
+
+	for(unsigned int i=0; i!=nslot; ++i) {
 		if( write2stdout ) {	// only use buffer 1
-			writebuffer.buffer1[i]  = new char[ BUFFER_SIZE_PER_BATCH_READ << 1 ];
+			writebuffer.buffer1[i]  = new char[ size << 1 ];
 			writebuffer.b1stored[i] = 0;
+			writebuffer.b1capacity[i] = size << 1;
 		} else {
-			writebuffer.buffer1[i]  = new char[ BUFFER_SIZE_PER_BATCH_READ ];
-			writebuffer.buffer2[i]  = new char[ BUFFER_SIZE_PER_BATCH_READ ];
+			writebuffer.buffer1[i]  = new char[ size ];
+			writebuffer.buffer2[i]  = new char[ size ];
 			writebuffer.b1stored[i] = 0;
 			writebuffer.b2stored[i] = 0;
+			writebuffer.b1capacity[i] = size;
+			writebuffer.b2capacity[i] = size;
 		}
+	}
 
+	for(unsigned int i=0; i!=nthread; ++i) {
 		kstat.dropped[i] = 0;
 		kstat.real_adapter[i] = 0;
 		kstat.tail_adapter[i] = 0;
@@ -67,55 +77,42 @@ void init_kstat_wrbuffer( ktrim_stat &kstat, writeBuffer &writebuffer, unsigned
 	}
 }
 
-void find_seed_pe( vector<unsigned int> &seed, const CPEREAD *read, const ktrim_param & kp ) {
-	seed.clear();
-	register const char *poffset  = read->seq1;
-	register const char *indexloc = poffset;
-	while( true ) {
-		indexloc = strstr( indexloc, kp.adapter_index1 );
-		if( indexloc == NULL )
-			break;
-		seed.push_back( indexloc - poffset );
-		++ indexloc;
-	}
-	poffset  = read->seq2;
-	indexloc = poffset;
-	while( true ) {
-		indexloc = strstr( indexloc, kp.adapter_index2 );
-		if( indexloc == NULL )
-			break;
-		seed.push_back( indexloc - poffset );
-		++ indexloc;
-	}
-	sort( seed.begin(), seed.end() );
-}
-
 // this function is slower than C++ version
 void workingThread_PE_C( unsigned int tn, unsigned int start, unsigned int end, CPEREAD *workingReads,
-					ktrim_stat *kstat, writeBuffer *writebuffer, const ktrim_param &kp ) {
-
-	writebuffer->b1stored[tn] = 0;
-	writebuffer->b2stored[tn] = 0;
+					ktrim_stat *kstat, OUT_QUEUE *oq, unsigned long seq, const ktrim_param &kp ) {
+
+	// update in v1.7: the output is stored in a slot of the ordered output queue
+	register writeBuffer *writebuffer = oq->wb;
+	register unsigned int k = oq_acquire( oq, seq );
+	writebuffer->b1stored[k] = 0;
+	writebuffer->b2stored[k] = 0;
+	if( kp.gzip_output )
+		writebuffer->nmark[k] = 0;
+	if( kp.use_writev ) {
+		writebuffer->iov1n[k] = 0;
+		writebuffer->iov2n[k] = 0;
+	}
 
-//	vector<unsigned int> seed;
-//	vector<unsigned int> :: iterator it, end_of_seed;
-	register int *seed = new int[ MAX_SEED_NUM ];
-	register int hit_seed;
-	register int *it, *end_of_seed;
+	register int adapter_pos;
+	BITPAR_READ br[2];
+	bitpar_init( br );
+	bitpar_init( br+1 );
 
 	register CPEREAD *wkr = workingReads + start;
 	for( unsigned int iii=end-start; iii; --iii, ++wkr ) {
+		// update in v1.7: start a new gzip member every GZ_MEMBER_READS reads
+		if( kp.gzip_output && (wkr-workingReads) % GZ_MEMBER_READS == 0 )
+			gz_mark_member( writebuffer, k, !kp.write2stdout );
+
 		// read size handling
 		if( wkr->size > wkr->size2 )
 			wkr->size = wkr->size2;
 
-		// remove the tail '\n'
-		// in fact, it is not essential to do this step, because '\n' has a very low ascii value (10)
-		// therefore it will be quality-trimmed
-		CPEREAD_resize( wkr, wkr->size - 1 );
+		// the tailing '\n' has been removed by the loaders (update in v1.7)
+		CPEREAD_resize( wkr, wkr->size );
 
 		// quality control
-		register int i = get_quality_trim_cycle_pe( wkr, kp );
+		register int i = simd.get_quality_trim_cycle_pe( wkr, kp );
 		if( i == 0 ) { // not long enough
 			++ kstat->dropped[ tn ];
 			continue;
@@ -126,58 +123,18 @@ void workingThread_PE_C( unsigned int tn, unsigned int start, unsigned int end,
 
 		// looking for seed target, 1 mismatch is allowed for these 2 seeds
 		// which means seq1 and seq2 at least should take 1 perfect seed match
-		//find_seed_pe( seed, wkr, kp );
-		//TODO: I donot need to find all the seeds, I can find-check, then next
-//		seed.clear();
-		hit_seed = 0;
-		register const char *poffset  = wkr->seq1;
-		register const char *indexloc = poffset;
-		while( true ) {
-			indexloc = strstr( indexloc, kp.adapter_index1 );
-			if( indexloc == NULL )
-				break;
-			//seed.push_back( indexloc - poffset );
-			seed[ hit_seed++ ] = indexloc - poffset;
-			++ indexloc;
-		}
-		poffset  = wkr->seq2;
-		indexloc = poffset;
-		while( true ) {
-			indexloc = strstr( indexloc, kp.adapter_index2 );
-			if( indexloc == NULL )
-				break;
-			//seed.push_back( indexloc - poffset );
-			seed[ hit_seed++ ] = indexloc - poffset;
-			++ indexloc;
-		}
-		//sort( seed.begin(), seed.end() );
-		end_of_seed = seed + hit_seed;
-		if( hit_seed != 0 )
-			sort( seed, seed + hit_seed );
+		adapter_pos = kp.use_bitpar ? simd.bitpar_find_adapter_pe( wkr, br, kp ) : simd.find_adapter_pe( wkr, kp );
 
 		register bool no_valid_adapter = true;
-		register unsigned int last_seed = impossible_seed;	// a position which cannot be a seed
-		//end_of_seed = seed.end();
-		//for( it=seed.begin(); it!=end_of_seed; ++it ) {
-		for( it=seed; it!=end_of_seed; ++it ) {
-			if( *it != last_seed ) {
-			// as there maybe the same value in seq1_seed and seq2_seed,
-			// use this to avoid re-calculate that pos
-				if( check_mismatch_dynamic_PE_C( wkr, *it, kp ) )
-					break;
-
-				last_seed = *it;
-			}
-		}
-		if( it != end_of_seed ) {	// adapter found
+		if( adapter_pos >= 0 ) {	// adapter found
 			no_valid_adapter = false;
 			++ kstat->real_adapter[tn];
-			if( *it >= kp.min_length )	{
-				CPEREAD_resize( wkr, *it );
+			if( adapter_pos >= kp.min_length )	{
+				CPEREAD_resize( wkr, adapter_pos );
 			} else {	// drop this read as its length is not enough
 				++ kstat->dropped[tn];
 
-				if( *it <= DIMER_INSERT )
+				if( adapter_pos <= DIMER_INSERT )
 					++ kstat->dimer[tn];
 				continue;
 			}
@@ -226,275 +183,160 @@ void workingThread_PE_C( unsigned int tn, unsigned int start, unsigned int end,
 			continue;
 
 		++ kstat->pass[tn];
-		if( kp.write2stdout ) {
-			writebuffer->b1stored[tn] += sprintf( writebuffer->buffer1[tn]+writebuffer->b1stored[tn],
-												"%s%s\n+\n%s\n%s%s\n+\n%s\n",
-												wkr->id1, wkr->seq1, wkr->qual1,
-												wkr->id2, wkr->seq2, wkr->qual2);
+		// update in v1.7: use memcpy instead of sprintf, or just record the pointers
+		if( kp.use_writev ) {
+			emit_fastq_iovec( writebuffer->iov1[k], writebuffer->iov1n[k], writebuffer->iov1capacity[k],
+								wkr->id1, wkr->id1_len, wkr->seq1, wkr->qual1, wkr->size );
+			if( kp.write2stdout )
+				emit_fastq_iovec( writebuffer->iov1[k], writebuffer->iov1n[k], writebuffer->iov1capacity[k],
+								wkr->id2, wkr->id2_len, wkr->seq2, wkr->qual2, wkr->size );
+			else
+				emit_fastq_iovec( writebuffer->iov2[k], writebuffer->iov2n[k], writebuffer->iov2capacity[k],
+								wkr->id2, wkr->id2_len, wkr->seq2, wkr->qual2, wkr->size );
+		} else if( kp.write2stdout ) {
+			emit_fastq_record( writebuffer->buffer1[k], writebuffer->b1stored[k], writebuffer->b1capacity[k],
+								wkr->id1, wkr->id1_len, wkr->seq1, wkr->qual1, wkr->size );
+			emit_fastq_record( writebuffer->buffer1[k], writebuffer->b1stored[k], writebuffer->b1capacity[k],
+								wkr->id2, wkr->id2_len, wkr->seq2, wkr->qual2, wkr->size );
 		} else {
-			writebuffer->b1stored[tn] += sprintf( writebuffer->buffer1[tn]+writebuffer->b1stored[tn],
-												"%s%s\n+\n%s\n", wkr->id1, wkr->seq1, wkr->qual1 );
-			writebuffer->b2stored[tn] += sprintf( writebuffer->buffer2[tn]+writebuffer->b2stored[tn],
-												"%s%s\n+\n%s\n", wkr->id2, wkr->seq2, wkr->qual2 );
+			emit_fastq_record( writebuffer->buffer1[k], writebuffer->b1stored[k], writebuffer->b1capacity[k],
+								wkr->id1, wkr->id1_len, wkr->seq1, wkr->qual1, wkr->size );
+			emit_fastq_record( writebuffer->buffer2[k], writebuffer->b2stored[k], writebuffer->b2capacity[k],
+								wkr->id2, wkr->id2_len, wkr->seq2, wkr->qual2, wkr->size );
 		}
 	}
 
-	//wait for my turn to output
-	while( true ) {
-		if( tn == write_thread ) {
-			if( kp.write2stdout ) {
-				fwrite( writebuffer->buffer1[tn], sizeof(char), writebuffer->b1stored[tn], stdout );
-			} else {
-				fwrite( writebuffer->buffer1[tn], sizeof(char), writebuffer->b1stored[tn], kp.fout1 );
-				fwrite( writebuffer->buffer2[tn], sizeof(char), writebuffer->b2stored[tn], kp.fout2 );
-			}
-			++ write_thread;
-			break;
-		} else {
-			this_thread::sleep_for( waiting_time_for_writing );
-		}
-	}
-	
-	delete [] seed;
+	// update in v1.7: compress the output in parallel, then hand it over to the writers
+	if( kp.gzip_output )
+		gz_compress_wrbuffer( writebuffer, k, !kp.write2stdout );
+	oq_submit( oq, seq );
+
+	bitpar_free( br );
+	bitpar_free( br+1 );
 }
 
-int process_multi_thread_PE_C( const ktrim_param &kp ) {
+/*
+ * update in v1.7: in multi-sample mode, samples is the array of the samples (with their own output files),
+ * and kp.R1s/R2s contain the input files of all the samples (see sample_handler.h); otherwise, samples
+ * is kp itself
+*/
+int process_multi_thread_PE_C( const ktrim_param &kp, const ktrim_param *samples, unsigned int nsample ) {
 	// IO speed-up
 	ios::sync_with_stdio( false );
 //	cin.tie( NULL );
 
-	// in this version, two data containers are used and auto-swapped for working and loading data
-	CPEREAD *readA, *readB;
-	register char *readA_data, *readB_data;
-	CPEREAD *workingReads, *loadingReads, *swapReads;
+	// update in v1.7: 2 threads load read1 and read2 into a ring of batches, and the others trim
+	// the pieces of the loaded batches; the threads live through the whole run (see pipeline.h)
+	READ_PIPE pipe;
 	ktrim_stat kstat;
 	writeBuffer writebuffer;
-//	vector<string> R1s, kp.R2s;
-	unsigned int totalFiles;
+	OUT_QUEUE oq;
+
+	// update in v1.7: in split mode, the mapped input files are parsed by all the threads (see fq_split.h)
+	FQ_SPLIT *split1 = NULL, *split2 = NULL;
+	if( kp.use_mmap ) {
+		split1 = fq_split_open( kp.R1s, kp.thread );
+		if( split1 != NULL ) {
+			split2 = fq_split_open( kp.R2s, kp.thread );
+			if( split2 == NULL ) {
+				fq_split_close( split1, kp.R1s.size() );
+				split1 = NULL;
+			}
+		}
+	}
+	unsigned int NumWkThreads = split1 ? kp.thread : kp.thread - 2;
+	unsigned int nslot = NumWkThreads << 2;	// each working thread could go a few pieces ahead of the writers
 
 // now I use 2 threads for init
 // prepare memory and file
+	// in split mode, more batches are loaded in parallel, and the reads point into the mapped files
+	pipe_init( &pipe, split1 ? kp.batches_in_flight : min( kp.batches_in_flight, BATCHES_IN_FLIGHT ), 2, kp.reads_per_batch,
+				kp.file_sample, nsample );
+	if( split1 && ! pipe_split( &pipe, split1, split2, kp.R1s.size() ) ) {
+		fq_split_close( split1, kp.R1s.size() );
+		fq_split_close( split2, kp.R2s.size() );
+		pipe_free( &pipe );
+		return 1;
+	}
 	omp_set_num_threads( 2 );
 	#pragma omp parallel
 	{
 		unsigned int tn = omp_get_thread_num();
 
 		if( tn == 0 ) {
-			readA = new CPEREAD[ READS_PER_BATCH ];
-			readB = new CPEREAD[ READS_PER_BATCH ];
-			readA_data = new char[ MEM_PE_READSET ];
-			readB_data = new char[ MEM_PE_READSET ];
-
-			for( register int i=0, j=0; i!=READS_PER_BATCH; ++i ) {
-				readA[i].id1   = readA_data + j;
-				readB[i].id1   = readB_data + j;
-				j += MAX_READ_ID;
-				readA[i].seq1  = readA_data + j;
-				readB[i].seq1  = readB_data + j;
-				j += MAX_READ_CYCLE;
-				readA[i].qual1 = readA_data + j;
-				readB[i].qual1 = readB_data + j;
-				j += MAX_READ_CYCLE;
-
-				readA[i].id2   = readA_data + j;
-				readB[i].id2   = readB_data + j;
-				j += MAX_READ_ID;
-				readA[i].seq2  = readA_data + j;
-				readB[i].seq2  = readB_data + j;
-				j += MAX_READ_CYCLE;
-				readA[i].qual2 = readA_data + j;
-				readB[i].qual2 = readB_data + j;
-				j += MAX_READ_CYCLE;
+			for( unsigned int i=0; i!=pipe.nbatch; ++i ) {
+				pipe.batches[i].reads = new CPEREAD[ kp.reads_per_batch ];
+				arena_init( pipe.batches[i].arena,   pipe.split ? 0 : arena_size( kp, kp.reads_per_batch ) );
+				arena_init( pipe.batches[i].arena+1, pipe.split ? 0 : arena_size( kp, kp.reads_per_batch ) );
 			}
 		} else {
-			init_kstat_wrbuffer( kstat, writebuffer, kp.thread, kp.write2stdout );
-
-			// deal with multiple input files
-			totalFiles = kp.R1s.size();
-			//cout << "\033[1;34mINFO: " << totalFiles << " paired fastq files will be loaded.\033[0m\n";
+			init_kstat_wrbuffer( kstat, writebuffer, kp.thread * nsample, nslot, kp.piece_buffer_size, kp.write2stdout );
+			if( kp.gzip_output )
+				init_gz_wrbuffer( writebuffer, nslot, kp.piece_buffer_size << (kp.write2stdout ? 1 : 0), !kp.write2stdout, kp.bgzf_output );
+			if( kp.use_writev )
+				init_iov_wrbuffer( writebuffer, nslot );
 		}
 	}
+	oq_open( &oq, &writebuffer, nslot, samples[0] );
 
 // start analysis
-	register unsigned int line = 0;
-	for( unsigned int fileCnt=0; fileCnt!=totalFiles; ++ fileCnt ) {
-		bool file_is_gz = false;
-		FILE *fq1, *fq2;
-		gzFile gfp1, gfp2;
-		register unsigned int i = kp.R1s[fileCnt].size() - 3;
-		register const char * p = kp.R1s[fileCnt].c_str();
-		register const char * q = kp.R2s[fileCnt].c_str();
-		if( p[i]=='.' && p[i+1]=='g' && p[i+2]=='z' ) {
-			file_is_gz = true;
-			gfp1 = gzopen( p, "r" );
-			gfp2 = gzopen( q, "r" );
-			if( gfp1==NULL || gfp2==NULL ) {
-				cerr << "\033[1;31mError: open fastq file failed!\033[0m\n";
-				return 104;
-			}
+	omp_set_num_threads( kp.thread );
+	#pragma omp parallel
+	{
+		unsigned int tn = omp_get_thread_num();
+		if( ! pipe.split && tn == kp.thread - 1 ) {
+			pipe_reader( &pipe, &oq, 0, kp.R1s, kp.thread >> 1, kp );
+		} else if( ! pipe.split && tn == kp.thread - 2 ) {
+			pipe_reader( &pipe, &oq, 1, kp.R2s, kp.thread >> 1, kp );
 		} else {
-			fq1 = fopen( p, "rt" );
-			fq2 = fopen( q, "rt" );
-			if( fq1==NULL || fq2==NULL ) {
-				cerr << "\033[1;31mError: open fastq file failed!\033[0m\n";
-				return 104;
+			READ_BATCH *b;
+			unsigned int piece;
+			while( pipe_next_piece( &pipe, &oq, b, piece ) ) {
+				unsigned int start = piece_start( b->loaded[0], piece );
+				unsigned int end   = piece_start( b->loaded[0], piece+1 );
+				workingThread_PE_C( tn + b->sample*kp.thread, start, end, (CPEREAD *)b->reads, &kstat, &oq, b->seq+piece, kp );
+				pipe_piece_done( &pipe, b );
+				if( oq_failed( &oq ) )	// the error has been reported by the writers
+					pipe_abort( &pipe, 103 );
 			}
 		}
-//		fprintf( stderr, "Loading files:\nRead1: %s\nRead2: %s\n", p, q );
-
-		// initialization
-		// get first batch of fastq reads
-		unsigned int loaded;
-		bool metEOF;
-		omp_set_num_threads( 2 );
-		#pragma omp parallel
-		{
-			unsigned int tn = omp_get_thread_num();
-			if( tn == 0 ) {
-				if( file_is_gz ) {
-					loaded = load_batch_data_PE_GZ( gfp1, readA, READS_PER_BATCH, true );
-					metEOF = gzeof( gfp1 );
-				} else {
-					loaded = load_batch_data_PE_C( fq1, readA, READS_PER_BATCH, true );
-					metEOF = feof( fq1 );
-				}
-			} else {
-				if( file_is_gz ) {
-					loaded = load_batch_data_PE_GZ( gfp2, readA, READS_PER_BATCH, false );
-				} else {
-					loaded = load_batch_data_PE_C( fq2, readA, READS_PER_BATCH, false );
-				}
-			}
-		}
-		if( loaded == 0 ) break;
-
-		loadingReads = readB;
-		workingReads = readA;
-		bool nextBatch = true;
-		unsigned int threadLoaded=0, threadLoaded2=0;
-		unsigned int NumWkThreads=0;
-		while( nextBatch ) {
-//			cerr << "Working on " << loaded << " reads\n";
-			// start parallalization
-			write_thread = 0;
-			omp_set_num_threads( kp.thread );
-			#pragma omp parallel
-			{
-				unsigned int tn = omp_get_thread_num();
-				// if EOF is met, then all threads are used for analysis
-				// otherwise 1 thread will do data loading
-				if( metEOF ) {
-					NumWkThreads = kp.thread;
-					unsigned int start = loaded * tn / kp.thread;
-					unsigned int end   = loaded * (tn+1) / kp.thread;
-					workingThread_PE_C( tn, start, end, workingReads, &kstat, &writebuffer, kp );
-					nextBatch = false;
-				} else {	// use 2 thread to load files, others for trimming
-					NumWkThreads = kp.thread - 2;
-					if( tn == kp.thread - 1 ) {
-						if( file_is_gz ) {
-							threadLoaded = load_batch_data_PE_GZ( gfp1, loadingReads, READS_PER_BATCH, true );
-							metEOF = gzeof( gfp1 );
-						} else {
-							threadLoaded = load_batch_data_PE_C( fq1, loadingReads, READS_PER_BATCH, true );
-							metEOF = feof( fq1 );
-						}
-//		cerr << "R1 loaded " << threadLoaded << ", pos=" << gztell(gfp2) << ", EOF=" << gzeof( gfp1 ) << "\n";
-						nextBatch = (threadLoaded!=0);
-				//cerr << "Loading thread: " << threadLoaded << ", " << metEOF << ", " << nextBatch << '\n';
-					} else if ( tn == kp.thread - 2 ) {
-						if( file_is_gz ) {
-							threadLoaded2 = load_batch_data_PE_GZ( gfp2, loadingReads, READS_PER_BATCH, false );
-						} else {
-							threadLoaded2 = load_batch_data_PE_C( fq2, loadingReads, READS_PER_BATCH, false );
-						}
-//		cerr << "R2 loaded " << threadLoaded2 << ", pos=" << gztell(gfp2) << ", EOF=" << gzeof( gfp2 )<< "\n";
-					} else {
-						unsigned int start = loaded * tn / NumWkThreads;
-						unsigned int end   = loaded * (tn+1) / NumWkThreads;
-						workingThread_PE_C( tn, start, end, workingReads, &kstat, &writebuffer, kp );
-					}
-				}
-			} // parallel body
-			// write output and update fastq statistics
-			// I cannot write fastq in each thread because it may cause unpaired reads
-			/*if( ! kp.write2stdout ) {
-				omp_set_num_threads( 2 );
-				#pragma omp parallel
-				{
-					unsigned int tn = omp_get_thread_num();
-					if( tn == 0 ) {
-						for( unsigned int ii=0; ii!=NumWkThreads; ++ii ) {
-							fwrite( writebuffer.buffer1[ii], sizeof(char), writebuffer.b1stored[ii], kp.fout1 );
-						}
-					} else {
-						for( unsigned int ii=0; ii!=NumWkThreads; ++ii ) {
-							fwrite( writebuffer.buffer2[ii], sizeof(char), writebuffer.b2stored[ii], kp.fout2 );
-						}
-					}
-				}
-			}*/
-			// check whether the read-loading is correct
-			if( threadLoaded != threadLoaded2 ) {
-				cerr << "ERROR: unequal read number for read1 (" << threadLoaded << ") and read2 (" << threadLoaded2 << ")!\n";
-				return 1;
+	} // parallel body
+
+	// update in v1.7: the buffers are also released on errors, and the readers have left their files
+	// to pipe_free (see pipe_reader)
+	if( pipe.error != 0 ) {
+		oq_abort( &oq );
+	} else if( ! oq_close( &oq ) ) {	// write the remaining pieces; the error has been reported by the writers
+		pipe.error = 103;
+	} else {
+		// write trim.log of each sample; the statistics of sample s are in [s*thread, (s+1)*thread)
+		for( unsigned int s=0; s!=nsample; ++s ) {
+			int dropped_all=0, real_all=0, tail_all=0, dimer_all=0, pass_all=0;
+			for( unsigned int i=s*kp.thread; i!=(s+1)*kp.thread; ++i ) {
+				dropped_all += kstat.dropped[i];
+				real_all  += kstat.real_adapter[i];
+				tail_all  += kstat.tail_adapter[i];
+				dimer_all += kstat.dimer[i];
+				pass_all  += kstat.pass[i];
 			}
-
-			line += loaded;
-			loaded = threadLoaded;
-			// swap workingReads and loadingReads for next loop
-			swapReads	 = loadingReads;
-			loadingReads = workingReads;
-			workingReads = swapReads;
-
-//			cerr << '\r' << line << " reads loaded\n";
-//			cerr << line << " reads loaded, metEOF=" << metEOF << ", next=" << nextBatch << "\n";
-		}//process 1 file
-
-		if( file_is_gz ) {
-			gzclose( gfp1 );
-			gzclose( gfp2 );
-		} else {
-			fclose( fq1 );
-			fclose( fq2 );
+			fprintf( samples[s].flog, "Total\t%u\nDropped\t%u\nAadaptor\t%u\nTailHit\t%u\nDimer\t%u\nPass\t%u\n",
+						pipe.line[s], dropped_all, real_all, tail_all, dimer_all, pass_all );
 		}
-//		cerr << '\n';
-	} // all input files are loaded
-	//cerr << "\rDone: " << line << " lines processed.\n";
-
-	// write trim.log
-	int dropped_all=0, real_all=0, tail_all=0, dimer_all=0, pass_all=0;
-	for( unsigned int i=0; i!=kp.thread; ++i ) {
-		dropped_all += kstat.dropped[i];
-		real_all  += kstat.real_adapter[i];
-		tail_all  += kstat.tail_adapter[i];
-		dimer_all += kstat.dimer[i];
-		pass_all  += kstat.pass[i];
 	}
-	fprintf( kp.flog, "Total\t%u\nDropped\t%u\nAadaptor\t%u\nTailHit\t%u\nDimer\t%u\nPass\t%u\n",
-				line, dropped_all, real_all, tail_all, dimer_all, pass_all );
+	fq_split_close( split1, kp.R1s.size() );
+	fq_split_close( split2, kp.R2s.size() );
 
 	//free memory
-	for(unsigned int i=0; i!=kp.thread; ++i) {
-		delete writebuffer.buffer1[i];
-		if( ! kp.write2stdout )
-			delete writebuffer.buffer2[i];
+	free_kstat_wrbuffer( kstat, writebuffer, nslot, true, kp );
+	for( unsigned int i=0; i!=pipe.nbatch; ++i ) {
+		delete [] (CPEREAD *)pipe.batches[i].reads;
+		arena_free( pipe.batches[i].arena );
+		arena_free( pipe.batches[i].arena+1 );
 	}
-	delete [] writebuffer.buffer1;
-	delete [] writebuffer.buffer2;
-
-	delete [] kstat.dropped;
-	delete [] kstat.real_adapter;
-	delete [] kstat.tail_adapter;
-	delete [] kstat.dimer;
-	delete [] kstat.pass;
-
-	delete [] readA;
-	delete [] readB;
-	delete [] readA_data;
-	delete [] readB_data;
+	register int retValue = pipe.error;
+	pipe_free( &pipe );
 
-	return 0;
+	return retValue;
 }
 
 int process_single_thread_PE_C( const ktrim_param &kp ) {
@@ -503,133 +345,110 @@ int process_single_thread_PE_C( const ktrim_param &kp ) {
 	ios::sync_with_stdio( false );
 //	cin.tie( NULL );
 
-	CPEREAD *read = new CPEREAD[ READS_PER_BATCH_ST ];
-	register char *read_data = new char[ MEM_PE_READSET_ST ];
-	
-	for( register int i=0, j=0; i!=READS_PER_BATCH; ++i ) {
-		read[i].id1   = read_data + j;
-		j += MAX_READ_ID;
-		read[i].seq1  = read_data + j;
-		j += MAX_READ_CYCLE;
-		read[i].qual1 = read_data + j;
-		j += MAX_READ_CYCLE;
-		
-		read[i].id2   = read_data + j;
-		j += MAX_READ_ID;
-		read[i].seq2  = read_data + j;
-		j += MAX_READ_CYCLE;
-		read[i].qual2 = read_data + j;
-		j += MAX_READ_CYCLE;
-	}
+	CPEREAD *read = new CPEREAD[ kp.reads_per_batch_st ];
+	READ_ARENA read_arena[2];
+	arena_init( read_arena,   arena_size( kp, kp.reads_per_batch_st ) );
+	arena_init( read_arena+1, arena_size( kp, kp.reads_per_batch_st ) );
 
+	// buffer for storing the modified reads
+	// update in v1.7: 2 buffers are used, one is being written by the writer threads while the other is filled
+	const unsigned int nslot = 2;
 	ktrim_stat kstat;
-	kstat.dropped	   = new unsigned int [ 1 ];
-	kstat.real_adapter = new unsigned int [ 1 ];
-	kstat.tail_adapter = new unsigned int [ 1 ];
-	kstat.dimer        = new unsigned int [ 1 ];
-	kstat.pass         = new unsigned int [ 1 ];
-	kstat.dropped[0] = 0;
-	kstat.real_adapter[0] = 0;
-	kstat.tail_adapter[0] = 0;
-	kstat.dimer[0] = 0;
-	kstat.pass[0]  = 0;
-
-	// buffer for storing the modified reads per thread
 	writeBuffer writebuffer;
-	writebuffer.buffer1  = new char * [ 1 ];
-	if( kp.write2stdout ) {
-		writebuffer.buffer1[0] = new char[ BUFFER_SIZE_PER_BATCH_READ_ST << 1 ];
-		writebuffer.b1stored = new unsigned int	[ 1 ];
-	} else {
-		writebuffer.buffer1[0] = new char[ BUFFER_SIZE_PER_BATCH_READ_ST ];
-
-		writebuffer.buffer2  = new char * [ 1 ];
-		writebuffer.buffer2[0] = new char[ BUFFER_SIZE_PER_BATCH_READ_ST ];
-	}
-	writebuffer.b1stored = new unsigned int	[ 1 ];
-	writebuffer.b2stored = new unsigned int	[ 1 ];
+	init_kstat_wrbuffer( kstat, writebuffer, 1, nslot, kp.batch_buffer_size_st, kp.write2stdout );
+	if( kp.gzip_output )
+		init_gz_wrbuffer( writebuffer, nslot, kp.batch_buffer_size_st << (kp.write2stdout ? 1 : 0), !kp.write2stdout, kp.bgzf_output );
+	if( kp.use_writev )
+		init_iov_wrbuffer( writebuffer, nslot );
+	OUT_QUEUE oq;
+	oq_open( &oq, &writebuffer, nslot, kp );
+
+	// update in v1.7: on errors, the loop stops with the exit code, and the files and buffers are
+	// released below as well
+	int retValue = 0;
 
 // deal with multiple input files
 	if( kp.R1s.size() != kp.R2s.size() ) {
 		cerr << "\033[1;31mError: incorrect files!\033[0m\n";
-		return 110;
+		retValue = 110;
 	}
 	unsigned int totalFiles = kp.R1s.size();
 	//cout << "\033[1;34mINFO: " << totalFiles << " paired fastq files will be loaded.\033[0m\n";
 
+	// update in v1.7: the files are read ahead while trimming, and the next files are opened in advance
+	FQ_LIST fl1, fl2;
+	fq_list_open( &fl1, kp.R1s, kp.use_mmap, 1, kp.gz_index, true );
+	fq_list_open( &fl2, kp.R2s, kp.use_mmap, 1, kp.gz_index, true );
+
 	register unsigned int line = 0;
-	for( unsigned int fileCnt=0; fileCnt!=totalFiles; ++ fileCnt ) {
-		bool file_is_gz = false;
-		FILE *fq1, *fq2;
-		gzFile gfp1, gfp2;
-		register unsigned int i = kp.R1s[fileCnt].size() - 3;
-		register const char * p = kp.R1s[fileCnt].c_str();
-		register const char * q = kp.R2s[fileCnt].c_str();
-		if( p[i]=='.' && p[i+1]=='g' && p[i+2]=='z' ) {
-			file_is_gz = true;
-			gfp1 = gzopen( p, "r" );
-			gfp2 = gzopen( q, "r" );
-			if( gfp1==NULL || gfp2==NULL ) {
-				cerr << "\033[1;31mError: open fastq file failed!\033[0m\n";
-				return 104;
-			}
-		} else {
-			fq1 = fopen( p, "rt" );
-			fq2 = fopen( q, "rt" );
-			if( fq1==NULL || fq2==NULL ) {
-				cerr << "\033[1;31mError: open fastq file failed!\033[0m\n";
-				return 104;
-			}
+	for( unsigned int fileCnt=0; retValue==0 && fileCnt!=totalFiles; ++ fileCnt ) {
+		FQ_READER *fq1, *fq2;
+		bool failed1, failed2;
+		fq1 = fq_list_next( &fl1, failed1 );
+		fq2 = fq_list_next( &fl2, failed2 );
+		if( failed1 || failed2 ) {
+			cerr << "\033[1;31mError: open fastq file failed!\033[0m\n";
+			if( fq1 != NULL ) fq_reader_close( fq1 );
+			if( fq2 != NULL ) fq_reader_close( fq2 );
+			retValue = 104;
+			break;
 		}
 
 		while( true ) {
 			// get fastq reads
-			unsigned int loaded;
-			if( file_is_gz ) {
-				loaded = load_batch_data_PE_both_GZ( gfp1, gfp2, read, READS_PER_BATCH_ST );
-			} else {
-				loaded = load_batch_data_PE_both_C( fq1, fq2, read, READS_PER_BATCH_ST );
+			unsigned int loaded, loaded2;
+			if( kp.use_writev )	// the reads may still be referred by the pending output
+				oq_wait( &oq, oq.next_seq );
+			loaded = load_batch_data_PE_both_C( fq1, fq2, read, read_arena, kp.reads_per_batch_st, loaded2 );
+			if( fq1->error || fq2->error ) {	// the error has been reported by the reader
+				retValue = 107;
+				break;
+			}
+			if( loaded != loaded2 ) {
+				cerr << "ERROR: unequal read number for read1 (" << loaded << ") and read2 (" << loaded2 << ")!\n";
+				retValue = 1;
+				break;
 			}
 			if( loaded == 0 ) break;
 
-			write_thread = 0;
-			workingThread_PE_C( 0, 0, loaded, read, &kstat, &writebuffer, kp );
-			// write output and update fastq statistics
-/*			if( ! kp.write2stdout ) {
-				fwrite( writebuffer.buffer1[0], sizeof(char), writebuffer.b1stored[0], kp.fout1 );
-				fwrite( writebuffer.buffer2[0], sizeof(char), writebuffer.b2stored[0], kp.fout2 );
-			}*/
+			// update in v1.7: the output is written by the writer threads while the next batch is trimmed
+			workingThread_PE_C( 0, 0, loaded, read, &kstat, &oq, oq.next_seq++, kp );
 
 			line += loaded;
 			//cerr << '\r' << line << " reads loaded";
-
-			if( file_is_gz ) {
-				if( gzeof( gfp1 ) ) break;
-			} else {
-				if( feof( fq2 ) ) break;
+			if( oq_failed( &oq ) ) {	// the error has been reported by the writers
+				retValue = 103;
+				break;
 			}
-		}
 
-		if( file_is_gz ) {
-			gzclose( gfp1 );
-			gzclose( gfp2 );
-		} else {
-			fclose( fq1 );
-			fclose( fq2 );
+			if( fq_reader_eof( fq1 ) && fq_reader_eof( fq2 ) ) break;
 		}
+
+		if( kp.use_writev )	// the output may refer to the mapped file
+			oq_wait( &oq, oq.next_seq );
+		fq_reader_close( fq1 );
+		fq_reader_close( fq2 );
 	}
+	fq_list_close( &fl1 );
+	fq_list_close( &fl2 );
 	//cerr << "\rDone: " << line << " lines processed.\n";
 
-	// write trim.log
-	fprintf( kp.flog, "Total\t%u\nDropped\t%u\nAadaptor\t%u\nTailHit\t%u\nDimer\t%u\nPass\t%u\n",
-				line, kstat.dropped[0], kstat.real_adapter[0], kstat.tail_adapter[0], kstat.dimer[0], kstat.pass[0] );
+	if( retValue != 0 ) {
+		oq_abort( &oq );
+	} else if( ! oq_close( &oq ) ) {	// the error has been reported by the writers
+		retValue = 103;
+	} else {
+		// write trim.log
+		fprintf( kp.flog, "Total\t%u\nDropped\t%u\nAadaptor\t%u\nTailHit\t%u\nDimer\t%u\nPass\t%u\n",
+					line, kstat.dropped[0], kstat.real_adapter[0], kstat.tail_adapter[0], kstat.dimer[0], kstat.pass[0] );
+	}
 
-	delete writebuffer.buffer1[0];
-	if( ! kp.write2stdout ) delete writebuffer.buffer2[0];
+	free_kstat_wrbuffer( kstat, writebuffer, nslot, true, kp );
 	delete [] read;
-	delete [] read_data;
+	arena_free( read_arena );
+	arena_free( read_arena+1 );
 
-	return 0;
+	return retValue;
 }
 
 int process_two_thread_PE_C( const ktrim_param &kp ) {
@@ -639,9 +458,11 @@ int process_two_thread_PE_C( const ktrim_param &kp ) {
 
 	// in this version, two data containers are used and auto-swapped for working and loading data
 	CPEREAD *readA;
-	register char *readA_data;
+	READ_ARENA readA_arena[2];
 	ktrim_stat kstat;
 	writeBuffer writebuffer;
+	OUT_QUEUE oq;
+	unsigned int nslot = kp.thread << 2;
 //	vector<string> R1s, R2s;
 	unsigned int totalFiles;
 
@@ -653,148 +474,139 @@ int process_two_thread_PE_C( const ktrim_param &kp ) {
 		unsigned int tn = omp_get_thread_num();
 
 		if( tn == 0 ) {
-			readA = new CPEREAD[ READS_PER_BATCH ];
-			readA_data = new char[ MEM_PE_READSET ];
-
-			for( register int i=0, j=0; i!=READS_PER_BATCH; ++i ) {
-				readA[i].id1   = readA_data + j;
-				j += MAX_READ_ID;
-				readA[i].seq1  = readA_data + j;
-				j += MAX_READ_CYCLE;
-				readA[i].qual1 = readA_data + j;
-				j += MAX_READ_CYCLE;
-
-				readA[i].id2   = readA_data + j;
-				j += MAX_READ_ID;
-				readA[i].seq2  = readA_data + j;
-				j += MAX_READ_CYCLE;
-				readA[i].qual2 = readA_data + j;
-				j += MAX_READ_CYCLE;
-			}
+			readA = new CPEREAD[ kp.reads_per_batch ];
+			arena_init( readA_arena,   arena_size( kp, kp.reads_per_batch ) );
+			arena_init( readA_arena+1, arena_size( kp, kp.reads_per_batch ) );
+
 		} else {
-			init_kstat_wrbuffer( kstat, writebuffer, kp.thread, kp.write2stdout );
+			init_kstat_wrbuffer( kstat, writebuffer, kp.thread, nslot, kp.piece_buffer_size, kp.write2stdout );
+			if( kp.gzip_output )
+				init_gz_wrbuffer( writebuffer, nslot, kp.piece_buffer_size << (kp.write2stdout ? 1 : 0), !kp.write2stdout, kp.bgzf_output );
+			if( kp.use_writev )
+				init_iov_wrbuffer( writebuffer, nslot );
 
 			// deal with multiple input files
 			totalFiles = kp.R1s.size();
 			//cout << "\033[1;34mINFO: " << totalFiles << " paired fastq files will be loaded.\033[0m\n";
 		}
 	}
+	oq_open( &oq, &writebuffer, nslot, kp );
 
+	// update in v1.7: the files are read ahead while trimming, and the next files are opened in advance
+	FQ_LIST fl1, fl2;
+	fq_list_open( &fl1, kp.R1s, kp.use_mmap, 1, kp.gz_index, true );
+	fq_list_open( &fl2, kp.R2s, kp.use_mmap, 1, kp.gz_index, true );
+
+	// update in v1.7: on errors, the loop stops with the exit code, and the files and buffers are
+	// released below as well
+	int retValue = 0;
+	if( kp.R1s.size() != kp.R2s.size() ) {
+		cerr << "\033[1;31mError: incorrect files!\033[0m\n";
+		retValue = 110;
+	}
 	register unsigned int line = 0;
-	for( unsigned int fileCnt=0; fileCnt!=totalFiles; ++ fileCnt ) {
-		bool file_is_gz = false;
-		FILE *fq1, *fq2;
-		gzFile gfp1, gfp2;
-		register unsigned int i = kp.R1s[fileCnt].size() - 3;
-		register const char * p = kp.R1s[fileCnt].c_str();
-		register const char * q = kp.R2s[fileCnt].c_str();
-		if( p[i]=='.' && p[i+1]=='g' && p[i+2]=='z' ) {
-			file_is_gz = true;
-			gfp1 = gzopen( p, "r" );
-			gfp2 = gzopen( q, "r" );
-			if( gfp1==NULL || gfp2==NULL ) {
-				cerr << "\033[1;31mError: open fastq file failed!\033[0m\n";
-				return 104;
-			}
-		} else {
-			fq1 = fopen( p, "rt" );
-			fq2 = fopen( q, "rt" );
-			if( fq1==NULL || fq2==NULL ) {
-				cerr << "\033[1;31mError: open fastq file failed!\033[0m\n";
-				return 104;
-			}
+	for( unsigned int fileCnt=0; retValue==0 && fileCnt!=totalFiles; ++ fileCnt ) {
+		FQ_READER *fq1, *fq2;
+		bool failed1, failed2;
+		fq1 = fq_list_next( &fl1, failed1 );
+		fq2 = fq_list_next( &fl2, failed2 );
+		if( failed1 || failed2 ) {
+			cerr << "\033[1;31mError: open fastq file failed!\033[0m\n";
+			if( fq1 != NULL ) fq_reader_close( fq1 );
+			if( fq2 != NULL ) fq_reader_close( fq2 );
+			retValue = 104;
+			break;
 		}
 //		fprintf( stderr, "Loading files:\nRead1: %s\nRead2: %s\n", p, q );
 
 		// initialization
 		// get first batch of fastq reads
 
-		// there is NO need to do rotation in 2-threads
+		// there is NO need to do rotation in 2-threads, as the files are read ahead by the I/O helper threads
 		unsigned int loaded1, loaded2;
-		bool metEOF;
+		bool metEOF, metEOF2;
 		while( true ) {
 			// load data
+			if( kp.use_writev )	// the reads may still be referred by the pending output
+				oq_wait( &oq, oq.next_seq );
 			omp_set_num_threads( 2 );
 			#pragma omp parallel
 			{
 				unsigned int tn = omp_get_thread_num();
 				if( tn == 0 ) {
-					if( file_is_gz ) {
-						loaded1 = load_batch_data_PE_GZ( gfp1, readA, READS_PER_BATCH, true );
-						metEOF = gzeof( gfp1 );
-					} else {
-						loaded1 = load_batch_data_PE_C( fq1, readA, READS_PER_BATCH, true );
-						metEOF = feof( fq1 );
-					}
+					loaded1 = load_batch_data_PE_C( fq1, readA, readA_arena, kp.reads_per_batch, true );
+					metEOF = fq_reader_eof( fq1 );
 				} else {
-					if( file_is_gz ) {
-						loaded2 = load_batch_data_PE_GZ( gfp2, readA, READS_PER_BATCH, false );
-					} else {
-						loaded2 = load_batch_data_PE_C( fq2, readA, READS_PER_BATCH, false );
-					}
+					loaded2 = load_batch_data_PE_C( fq2, readA, readA_arena+1, kp.reads_per_batch, false );
+					metEOF2 = fq_reader_eof( fq2 );
 				}
 			}
+			if( fq1->error || fq2->error ) {	// the error has been reported by the reader
+				retValue = 107;
+				break;
+			}
 			if( loaded1 != loaded2 ) {
 				cerr << "ERROR: unequal read number for read1 (" << loaded1 << ") and read2 (" << loaded2 << ")!\n";
-				return 1;
+				retValue = 1;
+				break;
 			}
 			if( loaded1 == 0 ) break;
 
 			// start analysis
-			write_thread = 0;
+			// update in v1.7: the 2 threads take the pieces of the batch dynamically
+			unsigned long seq = oq.next_seq;
+			unsigned int npiece = batch_npiece( loaded1 );
+			unsigned int next_piece = 0;
+			oq.next_seq += npiece;
 			omp_set_num_threads( 2 );
 			#pragma omp parallel
 			{
 				unsigned int tn = omp_get_thread_num();
-				register int middle = loaded1 >> 1;
-				if( tn == 0 ) {
-					workingThread_PE_C( 0,      0,  middle, readA, &kstat, &writebuffer, kp );
-				} else {
-					workingThread_PE_C( 1, middle, loaded1, readA, &kstat, &writebuffer, kp );
+				while( true ) {
+					unsigned int piece;
+					#pragma omp atomic capture
+					piece = next_piece ++;
+					if( piece >= npiece )
+						break;
+					workingThread_PE_C( tn, piece_start(loaded1, piece), piece_start(loaded1, piece+1), readA, &kstat, &oq, seq+piece, kp );
 				}
 			} // parallel body
-			// write output and update fastq statistics
-			/*if( ! kp.write2stdout ) {
-				fwrite( writebuffer.buffer1[0], sizeof(char), writebuffer.b1stored[0], kp.fout1 );
-				fwrite( writebuffer.buffer1[1], sizeof(char), writebuffer.b1stored[1], kp.fout1 );
-				fwrite( writebuffer.buffer2[0], sizeof(char), writebuffer.b2stored[0], kp.fout2 );
-				fwrite( writebuffer.buffer2[1], sizeof(char), writebuffer.b2stored[1], kp.fout2 );
-			}*/
 			line += loaded1;
-			if( metEOF )break;
+			if( oq_failed( &oq ) ) {	// the error has been reported by the writers
+				retValue = 103;
+				break;
+			}
+			// stop only if both files are done, otherwise the extra reads of read2 show up in the next
+			// load as unequal read numbers
+			if( metEOF && metEOF2 ) break;
 		}
 
-		if( file_is_gz ) {
-			gzclose( gfp1 );
-			gzclose( gfp2 );
-		} else {
-			fclose( fq1 );
-			fclose( fq2 );
-		}
+		if( kp.use_writev )	// the output may refer to the mapped file
+			oq_wait( &oq, oq.next_seq );
+		fq_reader_close( fq1 );
+		fq_reader_close( fq2 );
 	} // all input files are loaded
+	fq_list_close( &fl1 );
+	fq_list_close( &fl2 );
 	//cerr << "\rDone: " << line << " lines processed.\n";
 
-	// write trim.log
-	fprintf( kp.flog, "Total\t%u\nDropped\t%u\nAadaptor\t%u\nTailHit\t%u\nDimer\t%u\nPass\t%u\n",
-				line, kstat.dropped[0]+kstat.dropped[1], kstat.real_adapter[0]+kstat.real_adapter[1],
-				kstat.tail_adapter[0]+kstat.tail_adapter[1], kstat.dimer[0]+kstat.dimer[1], kstat.pass[0]+kstat.pass[1] );
-
-	//free memory
-	for(unsigned int i=0; i!=kp.thread; ++i) {
-		delete writebuffer.buffer1[i];
-		delete writebuffer.buffer2[i];
+	if( retValue != 0 ) {
+		oq_abort( &oq );
+	} else if( ! oq_close( &oq ) ) {	// the error has been reported by the writers
+		retValue = 103;
+	} else {
+		// write trim.log
+		fprintf( kp.flog, "Total\t%u\nDropped\t%u\nAadaptor\t%u\nTailHit\t%u\nDimer\t%u\nPass\t%u\n",
+					line, kstat.dropped[0]+kstat.dropped[1], kstat.real_adapter[0]+kstat.real_adapter[1],
+					kstat.tail_adapter[0]+kstat.tail_adapter[1], kstat.dimer[0]+kstat.dimer[1], kstat.pass[0]+kstat.pass[1] );
 	}
-	delete [] writebuffer.buffer1;
-	delete [] writebuffer.buffer2;
-	delete [] kstat.dropped;
-	delete [] kstat.real_adapter;
-	delete [] kstat.tail_adapter;
-	delete [] kstat.dimer;
-	delete [] kstat.pass;
 
+	//free memory
+	free_kstat_wrbuffer( kstat, writebuffer, nslot, true, kp );
 	delete [] readA;
-	delete [] readA_data;
+	arena_free( readA_arena );
+	arena_free( readA_arena+1 );
 
-	return 0;
+	return retValue;
 }
 
@@ -0,0 +1,327 @@
+/**
+ * Author: Ktrim contributors
+ * Date: Oct 2026
+ * Reader/worker pipeline for multi-thread mode: a ring of batches is loaded, trimmed and written
+ * by long-lived threads instead of one parallel region per batch
+ * This program is part of the Ktrim package
+**/
+
+#ifndef _KTRIM_PIPELINE_
+#define _KTRIM_PIPELINE_
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include "common.h"
+#include "util.h"
+#include "fq_reader.h"
+#include "fq_writer.h"
+#include "fq_split.h"
+
+using namespace std;
+
+/*
+ * update in v1.7: the reader threads (1 for single-end data, 2 for paired-end data, one per file)
+ * load batch n into batches[n % nbatch] as soon as batch (n - nbatch) has been trimmed, and each
+ * loaded batch is cut into pieces of READS_PER_PIECE reads, which are trimmed by whichever working
+ * thread is free (i.e., reads with many seeds do not hold back the other threads);
+ * the trimmed pieces are written in order by the output queue (see fq_writer.h)
+ * therefore loading, trimming and writing of different batches overlap, and there is no barrier
+ * between the batches
+ *
+ * in split mode (update in v1.7, see fq_split.h), there is no reader thread: a working thread that
+ * finds no piece to trim loads the next batch itself, so that several batches are parsed in parallel
+*/
+
+/*
+ * reads and arenas of the batches should be allocated by the caller
+ * in multi-sample mode, file_sample is the sample of each input file (see kp.file_sample), and
+ * the input files of all the samples are loaded as one stream
+*/
+void pipe_init( READ_PIPE *pp, unsigned int nbatch, unsigned int nreader, unsigned int batch_size,
+					const vector<unsigned int> &file_sample, unsigned int nsample ) {
+	pp->batches = new READ_BATCH[ nbatch ];
+	pp->nbatch  = nbatch;
+	pp->batch_size = batch_size;
+	pp->nreader = nreader;
+	for( unsigned int i=0; i!=nbatch; ++i ) {
+		pp->batches[i].nloader = 0;
+		pp->batches[i].npiece  = 0;
+	}
+	pp->nready = 0;
+	pp->next_dispatch = 0;
+	pp->nreleased = 0;
+	pp->released_seq = 0;
+	pp->line = new unsigned int[ nsample ];
+	for( unsigned int i=0; i!=nsample; ++i )
+		pp->line[i] = 0;
+	pp->file_sample = file_sample.empty() ? NULL : &file_sample[0];
+	pp->last_sample = 0;
+	pp->input_done = false;
+	pp->error = 0;
+	pp->split = false;
+	pp->next_load = 0;
+	pp->orphans.clear();
+}
+
+/*
+ * switch to split mode: the input files have been indexed by fq_split_open, and sp2 is NULL for
+ * single-end data; returns false if read1 and read2 have different numbers of reads
+*/
+bool pipe_split( READ_PIPE *pp, FQ_SPLIT *sp1, FQ_SPLIT *sp2, unsigned int nfile ) {
+	pp->split  = true;
+	pp->split1 = sp1;
+	pp->split2 = sp2;
+	if( ! fq_split_ranges( sp1, sp2, nfile, pp->batch_size, pp->ranges ) )
+		return false;
+	pp->input_done = pp->ranges.empty();
+	return true;
+}
+
+// the threads using the pipeline must have finished
+void pipe_free( READ_PIPE *pp ) {
+	for( unsigned int i=0; i!=pp->orphans.size(); ++i )
+		fq_reader_close( pp->orphans[i] );
+	pp->orphans.clear();
+	delete [] pp->batches;
+	delete [] pp->line;
+}
+
+// stop the pipeline because of an error
+void pipe_abort( READ_PIPE *pp, int error ) {
+	{
+		lock_guard<mutex> lock( pp->lock );
+		if( pp->error == 0 )
+			pp->error = error;
+	}
+	pp->batch_ready.notify_all();
+	pp->batch_free.notify_all();
+}
+
+/*
+ * wait until batches [0, n) have been trimmed; in writev mode, their output must also have been
+ * written as it refers to the loaded reads
+ * returns false if the pipeline is aborted
+*/
+bool pipe_wait_released( READ_PIPE *pp, OUT_QUEUE *oq, unsigned long n, bool use_writev ) {
+	unsigned long seq;
+	{
+		unique_lock<mutex> lock( pp->lock );
+		pp->batch_free.wait( lock, [pp, n]{ return pp->nreleased >= n || pp->error; } );
+		if( pp->error )
+			return false;
+		seq = pp->released_seq;
+	}
+	if( use_writev )
+		oq_wait( oq, seq );
+	return true;
+}
+
+// the next loaded batch b is ready for trimming; the lock must be held
+void inline pipe_ready( READ_PIPE *pp, OUT_QUEUE *oq, READ_BATCH *b, unsigned int loaded ) {
+	b->npiece = batch_npiece( loaded );
+	b->seq = oq->next_seq;
+	oq->next_seq += b->npiece;
+	b->next_piece = 0;
+	b->piece_done = 0;
+	if( b->sample != pp->last_sample ) {
+		oq_set_sample( oq, b->seq, b->sample );
+		pp->last_sample = b->sample;
+	}
+	pp->line[ b->sample ] += loaded;
+	++ pp->nready;
+}
+
+/*
+ * reader r has loaded batch n (of the sample); the batch is ready for trimming when all the readers
+ * have loaded it; an empty batch means the end of input
+*/
+void pipe_loaded( READ_PIPE *pp, OUT_QUEUE *oq, unsigned long n, unsigned int r, unsigned int loaded, unsigned int sample ) {
+	{
+		lock_guard<mutex> lock( pp->lock );
+		register READ_BATCH *b = pp->batches + n % pp->nbatch;
+		b->loaded[r] = loaded;
+		b->sample = sample;
+		if( ++ b->nloader != pp->nreader )
+			return;
+
+		b->nloader = 0;
+		if( pp->nreader == 2 && b->loaded[0] != b->loaded[1] ) {
+			cerr << "ERROR: unequal read number for read1 (" << b->loaded[0] << ") and read2 (" << b->loaded[1] << ")!\n";
+			if( pp->error == 0 )
+				pp->error = 1;
+		} else if( loaded == 0 ) {
+			pp->input_done = true;
+		} else {
+			pipe_ready( pp, oq, b, loaded );
+		}
+	}
+	pp->batch_ready.notify_all();
+	pp->batch_free.notify_all();
+}
+
+/*
+ * a reader stops because of an error (or the pipeline is aborted): the file opened in advance is
+ * closed now, while the files being read (fq could be NULL) are left to pipe_free, as the working
+ * threads may still be trimming their reads
+*/
+void pipe_reader_stop( READ_PIPE *pp, FQ_LIST *fl, FQ_READER *fq, const vector<FQ_READER *> &closing ) {
+	fq_list_close( fl );
+	lock_guard<mutex> lock( pp->lock );
+	if( fq != NULL )
+		pp->orphans.push_back( fq );
+	pp->orphans.insert( pp->orphans.end(), closing.begin(), closing.end() );
+}
+
+/*
+ * reader r loads the files one by one into the batches without waiting for the batches of the
+ * previous file, and the next file is opened in advance (see fq_list_next); a file is closed
+ * when its batches have been released, as the reads may point into the mapped file
+*/
+void pipe_reader( READ_PIPE *pp, OUT_QUEUE *oq, unsigned int r, const vector<string> &files,
+					unsigned int gz_thread, const ktrim_param &kp ) {
+	FQ_READER *fq = NULL;
+	FQ_LIST fl;
+	bool failed;
+	unsigned int fileCnt = 0;
+	fq_list_open( &fl, files, kp.use_mmap, gz_thread, kp.gz_index, false );
+	vector<FQ_READER *> closing;
+	vector<unsigned long> closing_batch;	// the file could be closed when batches before it are released
+
+	register unsigned long n;
+	for( n=0; ; ++n ) {
+		// wait until the batch could be reused
+		if( n >= pp->nbatch && ! pipe_wait_released( pp, oq, n - pp->nbatch + 1, kp.use_writev ) ) {
+			pipe_reader_stop( pp, &fl, fq, closing );
+			return;
+		}
+		while( ! closing.empty() && closing_batch[0] + pp->nbatch <= n + 1 ) {
+			fq_reader_close( closing[0] );
+			closing.erase( closing.begin() );
+			closing_batch.erase( closing_batch.begin() );
+		}
+
+		register READ_BATCH *b = pp->batches + n % pp->nbatch;
+		unsigned int loaded = 0;
+		while( true ) {
+			if( fq == NULL ) {
+				fq = fq_list_next( &fl, failed );
+				fileCnt = fl.next - 1;
+				if( failed ) {
+					cerr << "\033[1;31mError: open fastq file failed!\033[0m\n";
+					pipe_reader_stop( pp, &fl, NULL, closing );
+					pipe_abort( pp, 104 );
+					return;
+				}
+				if( fq == NULL )
+					break;
+			}
+
+			if( kp.paired_end_data )
+				loaded = load_batch_data_PE_C( fq, (CPEREAD *)b->reads, b->arena+r, pp->batch_size, r==0 );
+			else
+				loaded = load_batch_data_SE_C( fq, (CSEREAD *)b->reads, b->arena, pp->batch_size );
+			if( fq->error ) {	// the error has been reported by the reader
+				pipe_reader_stop( pp, &fl, fq, closing );
+				pipe_abort( pp, 107 );
+				return;
+			}
+			if( loaded==0 || fq_reader_eof(fq) ) {	// move to the next file
+				closing.push_back( fq );
+				closing_batch.push_back( loaded ? n+1 : n );
+				fq = NULL;
+			}
+			if( loaded != 0 )
+				break;
+		}
+
+		pipe_loaded( pp, oq, n, r, loaded, pp->file_sample ? pp->file_sample[fileCnt] : 0 );
+		if( loaded == 0 )
+			break;
+	}
+
+	if( ! pipe_wait_released( pp, oq, n, kp.use_writev ) ) {
+		pipe_reader_stop( pp, &fl, NULL, closing );
+		return;
+	}
+	for( unsigned int i=0; i!=closing.size(); ++i )
+		fq_reader_close( closing[i] );
+}
+
+/*
+ * split mode: load batch n, whose buffer has been released, without holding the lock
+ * the batches may be loaded out of order, but they are made ready in order, as the sequence
+ * numbers of the output pieces are assigned here
+*/
+void pipe_load_split( READ_PIPE *pp, OUT_QUEUE *oq, unique_lock<mutex> &lock, unsigned long n ) {
+	register READ_BATCH *b = pp->batches + n % pp->nbatch;
+	register const FQ_RANGE *r = &pp->ranges[n];
+	lock.unlock();
+	if( pp->split2 != NULL )
+		fq_split_load_PE( pp->split1, pp->split2, r, (CPEREAD *)b->reads );
+	else
+		fq_split_load_SE( pp->split1, r, (CSEREAD *)b->reads );
+	lock.lock();
+
+	b->loaded[0] = r->num;
+	b->sample = pp->file_sample ? pp->file_sample[r->fileCnt] : 0;
+	b->nloader = 1;
+	while( pp->nready < pp->next_load ) {
+		b = pp->batches + pp->nready % pp->nbatch;
+		if( b->nloader == 0 )
+			break;
+		b->nloader = 0;
+		pipe_ready( pp, oq, b, b->loaded[0] );
+	}
+	if( pp->nready == pp->ranges.size() )
+		pp->input_done = true;
+	pp->batch_ready.notify_all();
+}
+
+/*
+ * get the next piece to trim for a working thread
+ * returns false if there is no more piece (or the pipeline is aborted)
+*/
+bool pipe_next_piece( READ_PIPE *pp, OUT_QUEUE *oq, READ_BATCH * &b, unsigned int &piece ) {
+	unique_lock<mutex> lock( pp->lock );
+	while( true ) {
+		if( pp->error )
+			return false;
+		if( pp->next_dispatch < pp->nready )
+			break;
+		if( pp->input_done )
+			return false;
+		if( pp->split && pp->next_load < pp->ranges.size() && pp->next_load < pp->nreleased + pp->nbatch )
+			pipe_load_split( pp, oq, lock, pp->next_load ++ );
+		else
+			pp->batch_ready.wait( lock );
+	}
+
+	b = pp->batches + pp->next_dispatch % pp->nbatch;
+	piece = b->next_piece ++;
+	if( b->next_piece == b->npiece )
+		++ pp->next_dispatch;
+	return true;
+}
+
+// a piece of batch b has been trimmed; release the batches whose pieces are all trimmed, in order
+void pipe_piece_done( READ_PIPE *pp, READ_BATCH *b ) {
+	{
+		lock_guard<mutex> lock( pp->lock );
+		++ b->piece_done;
+		while( pp->nreleased < pp->nready ) {
+			register READ_BATCH *c = pp->batches + pp->nreleased % pp->nbatch;
+			if( c->piece_done != c->npiece )
+				break;
+			pp->released_seq = c->seq + c->npiece;
+			++ pp->nreleased;
+		}
+	}
+	pp->batch_free.notify_all();
+	if( pp->split )
+		pp->batch_ready.notify_all();
+}
+
+#endif
@@ -0,0 +1,160 @@
+/**
+ * Author: Ktrim contributors
+ * Date: Oct 2026
+ * Vectorized quality window check
+ * This program is part of the Ktrim package
+**/
+
+/*
+ * update in v1.7: instead of walking the quality strings from the 3' end with a nested loop over the
+ * window, the cycles are compared with the quality threshold in blocks of QUAL_BLOCK (16, 32 or 64 lanes
+ * at once), giving a bitmask of the passing cycles (of both reads for paired-end data); then the
+ * windows that pass are found by ANDing the mask with its shifts, and the last one by clz
+ * the blocks are aligned to the 3' end of the read, so only the first block of a read is partial
+*/
+const unsigned int QUAL_BLOCK = 64;
+
+#if defined(SIMD_USE_AVX2) && ! defined(SIMD_USE_AVX512)
+uint32_t inline qual_mask32( const char *p, const __m256i &t ) {
+	return (uint32_t) _mm256_movemask_epi8( _mm256_cmpgt_epi8( _mm256_loadu_si256((const __m256i *)p), t ) );
+}
+#elif defined(SIMD_USE_SSE) && ! defined(SIMD_USE_AVX512)
+uint32_t inline qual_mask16( const char *p, const __m128i &t ) {
+	return (uint32_t) _mm_movemask_epi8( _mm_cmpgt_epi8( _mm_loadu_si128((const __m128i *)p), t ) );
+}
+#endif
+
+// bit i is set if p[i] >= quality (0 < quality < 128), for the 64 cycles from p on
+uint64_t inline qual_mask64( const char *p, char quality ) {
+#if defined(SIMD_USE_AVX512)
+	return (uint64_t) _mm512_cmpge_epi8_mask( _mm512_loadu_si512(p), _mm512_set1_epi8(quality) );
+#elif defined(SIMD_USE_AVX2)
+	const __m256i t = _mm256_set1_epi8( quality-1 );
+	return (uint64_t) qual_mask32( p, t ) | ((uint64_t) qual_mask32( p+32, t ) << 32);
+#elif defined(SIMD_USE_SSE)
+	const __m128i t = _mm_set1_epi8( quality-1 );
+	return (uint64_t) qual_mask16( p,    t )        | ((uint64_t) qual_mask16( p+16, t ) << 16) |
+		  ((uint64_t) qual_mask16( p+32, t ) << 32) | ((uint64_t) qual_mask16( p+48, t ) << 48);
+#else
+	register uint64_t mask = 0;
+	for( register unsigned int i=0; i!=64; ++i )
+		if( p[i] >= quality )
+			mask |= (uint64_t)1 << i;
+	return mask;
+#endif
+}
+
+/*
+ * the passing cycles in [base, base+QUAL_BLOCK) of p (and q if it is not NULL); the cycles out of [0, n)
+ * do not pass, as the window could not start before the read
+*/
+uint64_t inline qual_mask( const char *p, const char *q, int n, int base, char quality ) {
+	if( base >= 0 && base + (int)QUAL_BLOCK <= n )
+		return q ? qual_mask64( p+base, quality ) & qual_mask64( q+base, quality ) : qual_mask64( p+base, quality );
+
+	register uint64_t mask = 0;
+	register int i = ( base > 0 ) ? base : 0;
+	register int end = ( base + (int)QUAL_BLOCK < n ) ? base + QUAL_BLOCK : n;
+	for( ; i<end; ++i )
+		if( p[i] >= quality && ( q == NULL || q[i] >= quality ) )
+			mask |= (uint64_t)1 << (i - base);
+	return mask;
+}
+
+// bit t is set if bits [t-w+1, t] are all set, where lo is the block before hi (0 < w <= QUAL_BLOCK)
+uint64_t inline qual_window_run( uint64_t hi, uint64_t lo, unsigned int w ) {
+	register unsigned int len, s;
+	for( len=1; len<w; len+=s ) {	// runs of len are doubled (or extended to w)
+		s = ( len << 1 <= w ) ? len : w - len;
+		hi &= (hi << s) | (lo >> (64 - s));
+		lo &= lo << s;
+	}
+	return hi;
+}
+
+/*
+ * the last cycle i >= stop whose window (i.e., cycles [i-w+1, i]) passes in the n cycles of p (and q for
+ * paired-end reads); returns i+1, or 0 if there is none
+ * the block before is only loaded if no window is found within the block
+*/
+int qual_trim_cycle( const char *p, const char *q, int n, int stop, char quality, unsigned int w ) {
+	register int base = n - QUAL_BLOCK;
+	register uint64_t hi = qual_mask( p, q, n, base, quality ), lo, run, valid;
+	for( ; base + (int)QUAL_BLOCK > stop; base -= QUAL_BLOCK ) {
+		valid = ( base >= stop ) ? ~(uint64_t)0 : ~(uint64_t)0 << (stop - base);
+		run = qual_window_run( hi, 0, w ) & valid;
+		if( run )
+			return base + 64 - __builtin_clzll( run );
+
+		lo  = qual_mask( p, q, n, base - QUAL_BLOCK, quality );
+		run = qual_window_run( hi, lo, w ) & valid;
+		if( run )
+			return base + 64 - __builtin_clzll( run );
+		hi = lo;
+	}
+	return 0;
+}
+
+// update in v1.2: support window check
+int get_quality_trim_cycle_se( const char *p, const int total_size, const ktrim_param &kp ) {
+	register int i, j, k;
+	register int stop = kp.min_length-1;
+	// update in v1.7: check the windows by bitmasks (see qual_trim_cycle) unless the window is too large
+	if( kp.window <= QUAL_BLOCK && kp.quality > 0 && kp.quality < 128 )
+		return qual_trim_cycle( p, NULL, total_size, stop, kp.quality, kp.window );
+
+	for( i=total_size-1; i>=stop; ) {
+		if( p[i] >= kp.quality ) {
+			k = i - kp.window;
+			for( j=i-1; j!=k; --j ) {
+				if( j<0 || p[j]<kp.quality ) {
+					break;
+				}
+			}
+			if( j == k ) { // find the quality trimming position
+				break;
+			} else {	// there is a low-quality base in the middle
+				i = j - 1;
+			}
+		} else {
+			-- i;
+		}
+	}
+
+	if( i >= stop )
+		return i + 1;
+	else
+		return 0;
+}
+
+int get_quality_trim_cycle_pe( const CPEREAD *read, const ktrim_param &kp ) {
+	register int i, j, k;
+	register int stop = kp.min_length - 1;
+	const char *p = read->qual1;
+	const char *q = read->qual2;
+	if( kp.window <= QUAL_BLOCK && kp.quality > 0 && kp.quality < 128 )
+		return qual_trim_cycle( p, q, read->size, stop, kp.quality, kp.window );
+
+	for( i=read->size-1; i>=stop; ) {
+		if( p[i]>=kp.quality && q[i]>=kp.quality ) {
+			k = i - kp.window;
+			for( j=i-1; j!=k; --j ) {
+				if( j<0 || p[j]<kp.quality || q[j]<kp.quality ) {
+					break;
+				}
+			}
+			if( j == k ) { // find the quality trimming position
+				break;
+			} else {
+				i = j - 1;
+			}
+		} else {
+			-- i;
+		}
+	}
+	
+	if( i >= stop )
+		return i + 1;
+	else
+		return 0;
+}
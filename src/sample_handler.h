@@ -0,0 +1,75 @@
+/**
+ * Author: Ktrim contributors
+ * Date: Oct 2026
+ * Multi-sample mode: trim the samples in a list, each with its own output files, in one run
+ * This program is part of the Ktrim package
+**/
+
+#ifndef _KTRIM_SAMPLE_HANDLER_
+#define _KTRIM_SAMPLE_HANDLER_
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include "common.h"
+
+using namespace std;
+
+/*
+ * update in v1.7: in multi-thread mode, the input files of all the samples are loaded as one stream
+ * by the pipeline (see pipeline.h), i.e., the samples share the threads, batches and write buffers,
+ * and there is no pause between the samples; each batch belongs to one sample, its output pieces are
+ * written to the files of that sample (see fq_writer.h), and the statistics are kept per sample
+ * with 1 or 2 threads, the samples are trimmed one after another
+*/
+int process_samples( const ktrim_param &kp ) {
+	register unsigned int nsample = kp.outpres.size();
+	ktrim_param *samples = new ktrim_param[ nsample ];
+	register unsigned int i, j;
+	int retValue = 0;
+	for( i=0, j=0; i!=nsample; ++i ) {
+		samples[i] = kp;
+		samples[i].outpre = (char *) kp.outpres[i].c_str();
+		samples[i].R1s.clear();
+		samples[i].R2s.clear();
+		samples[i].file_sample.clear();
+		for( ; j!=kp.R1s.size() && kp.file_sample[j]==i; ++j ) {
+			samples[i].R1s.push_back( kp.R1s[j] );
+			if( kp.paired_end_data )
+				samples[i].R2s.push_back( kp.R2s[j] );
+		}
+		retValue = open_output_files( samples[i] );
+		if( retValue != 0 ) {	// close the files of the previous samples
+			for( j=0; j!=i; ++j )
+				close_files( samples[j] );
+			delete [] samples;
+			return retValue;
+		}
+	}
+
+	if( kp.thread >= 3 ) {
+		if( kp.paired_end_data )
+			retValue = process_multi_thread_PE_C( kp, samples, nsample );
+		else
+			retValue = process_multi_thread_SE_C( kp, samples, nsample );
+	} else {
+		for( i=0; i!=nsample && retValue==0; ++i ) {
+			if( kp.paired_end_data ) {
+				if( kp.thread == 1 )
+					retValue = process_single_thread_PE_C( samples[i] );
+				else
+					retValue = process_two_thread_PE_C( samples[i] );
+			} else {
+				retValue = process_single_thread_SE_C( samples[i] );
+			}
+		}
+	}
+
+	for( i=0; i!=nsample; ++i )
+		close_files( samples[i] );
+	delete [] samples;
+
+	return retValue;
+}
+
+#endif
@@ -15,58 +15,49 @@
 #include <zlib.h>
 #include "common.h"
 #include "util.h"
+#include "gz_writer.h"
+#include "fq_writer.h"
+#include "pipeline.h"
+#include "simd.h"
 using namespace std;
 
+// update in v1.7: reads are not null-terminated, so only the size is changed
 void inline CSEREAD_resize( CSEREAD * cr, int n ) {
-	cr->seq[ n] = 0;
-	cr->qual[n] = 0;
-	cr->size    = n;
-}
-
-void find_seed( vector<unsigned int> &seed, CSEREAD *read, const ktrim_param & kp ) {
-	seed.clear();
-	register char *poffset  = read->seq;
-	register char *indexloc = poffset;
-	while( true ) {
-		indexloc = strstr( indexloc, kp.adapter_index1 );
-		if( indexloc == NULL )
-			break;
-		seed.push_back( indexloc - poffset );
-		indexloc ++;
-	}
-	poffset  = read->seq + OFFSET_INDEX3;
-	indexloc = poffset;
-	while( true ) {
-		indexloc = strstr( indexloc, kp.adapter_index3 );
-		if( indexloc == NULL )
-			break;
-		seed.push_back( indexloc - poffset );
-		indexloc ++;
-	}
-	sort( seed.begin(), seed.end() );
+	cr->size = n;
 }
 
 void workingThread_SE_C( unsigned int tn, unsigned int start, unsigned int end, CSEREAD *workingReads,
-							ktrim_stat *kstat, writeBuffer *writebuffer, const ktrim_param &kp ) {
+							ktrim_stat *kstat, OUT_QUEUE *oq, unsigned long seq, const ktrim_param &kp ) {
 
 //	fprintf( stderr, "=== working thread %d: %d - %d\n", tn, start, end ), "\n";
-	writebuffer->b1stored[tn] = 0;
+	// update in v1.7: the output is stored in a slot of the ordered output queue
+	register writeBuffer *writebuffer = oq->wb;
+	register unsigned int k = oq_acquire( oq, seq );
+	writebuffer->b1stored[k] = 0;
+	if( kp.gzip_output )
+		writebuffer->nmark[k] = 0;
+	if( kp.use_writev )
+		writebuffer->iov1n[k] = 0;
 
 	register int i, j;
-	register unsigned int last_seed;
-	vector<unsigned int> seed;
-	vector<unsigned int> :: iterator it;
+	register int adapter_pos;
 	const char *p, *q;
+	BITPAR_READ br;
+	bitpar_init( &br );
 
 	register CSEREAD *wkr = workingReads + start;
 	for( unsigned int ii=start; ii!=end; ++ii, ++wkr ) {
+		// update in v1.7: start a new gzip member every GZ_MEMBER_READS reads
+		if( kp.gzip_output && ii % GZ_MEMBER_READS == 0 )
+			gz_mark_member( writebuffer, k, false );
+
 //		fprintf( stderr, "working: %d, %s\n", ii, wkr->id );
 		// quality control
 		p = wkr->qual;
 		j = wkr->size;
 
 		// update in v1.2: support window check
-		i = get_quality_trim_cycle_se( p, j, kp );
+		i = simd.get_quality_trim_cycle_se( p, j, kp );
 
 		if( i == 0 ) { // not long enough
 			++ kstat->dropped[ tn ];
@@ -78,30 +69,18 @@ void workingThread_SE_C( unsigned int tn, unsigned int start, unsigned int end,
 
 		// looking for seed target, 1 mismatch is allowed for these 2 seeds
 		// which means seq1 and seq2 at least should take 1 perfect seed match
-		find_seed( seed, wkr, kp );
-
-		last_seed = impossible_seed;	// a position which cannot be in seed
-		for( it=seed.begin(); it!=seed.end(); ++it ) {
-			if( *it != last_seed ) {
-//				fprintf( stderr, " check seed: %d\n", *it );
-			// as there maybe the same value in seq1_seed and seq2_seed,
-			// use this to avoid re-calculate that pos
-				if( check_mismatch_dynamic_SE_C( wkr, *it, kp ) )
-					break;
-		
-				last_seed = *it;
-			}
-		}
+		adapter_pos = kp.use_bitpar ? simd.bitpar_find_adapter_se( wkr, &br, kp ) : simd.find_adapter_se( wkr, kp );
+
 		register bool no_valid_adapter = true;
-		if( it != seed.end() ) {	// adapter found
+		if( adapter_pos >= 0 ) {	// adapter found
 			no_valid_adapter = false;
 			++ kstat->real_adapter[tn];
-			if( *it >= kp.min_length )	{
-				CSEREAD_resize( wkr, *it );
+			if( adapter_pos >= kp.min_length )	{
+				CSEREAD_resize( wkr, adapter_pos );
 			} else {	// drop this read as its length is not enough
 				++ kstat->dropped[tn];
 
-				if( *it <= DIMER_INSERT )
+				if( adapter_pos <= DIMER_INSERT )
 				  ++ kstat->dimer[tn];
 
 				continue;
@@ -123,65 +102,78 @@ void workingThread_SE_C( unsigned int tn, unsigned int start, unsigned int end,
 			continue;
 
 		++ kstat->pass[tn];
-		writebuffer->b1stored[tn] += sprintf( writebuffer->buffer1[tn]+writebuffer->b1stored[tn],
-											"%s%s\n+\n%s\n", wkr->id, wkr->seq, wkr->qual);
+		// update in v1.7: use memcpy instead of sprintf, or just record the pointers
+		if( kp.use_writev )
+			emit_fastq_iovec( writebuffer->iov1[k], writebuffer->iov1n[k], writebuffer->iov1capacity[k],
+								wkr->id, wkr->id_len, wkr->seq, wkr->qual, wkr->size );
+		else
+			emit_fastq_record( writebuffer->buffer1[k], writebuffer->b1stored[k], writebuffer->b1capacity[k],
+								wkr->id, wkr->id_len, wkr->seq, wkr->qual, wkr->size );
 	}
 
-	// wait for my turn to write
-	while( true ) {
-		if( tn == write_thread ) {
-//			cerr << "Thread " << tn << " is writing.\n";
-			fwrite( writebuffer->buffer1[tn], sizeof(char), writebuffer->b1stored[tn], kp.fout1 );
-			++ write_thread;
-			break;
-		} else {
-			this_thread::sleep_for( waiting_time_for_writing );
-		}
-	}
+	// update in v1.7: compress the output in parallel, then hand it over to the writer
+	if( kp.gzip_output )
+		gz_compress_wrbuffer( writebuffer, k, false );
+	oq_submit( oq, seq );
+
+	bitpar_free( &br );
 }
 
-int process_multi_thread_SE_C( const ktrim_param &kp ) {
+/*
+ * update in v1.7: in multi-sample mode, samples is the array of the samples (with their own output files),
+ * and kp.R1s/R2s contain the input files of all the samples (see sample_handler.h); otherwise, samples
+ * is kp itself
+*/
+int process_multi_thread_SE_C( const ktrim_param &kp, const ktrim_param *samples, unsigned int nsample ) {
 	// IO speed-up
 //	ios::sync_with_stdio( false );
 //	cin.tie( NULL );
 
-	// in this version, two data containers are used and auto-swapped for working and loading data
-	CSEREAD *readA = new CSEREAD[ READS_PER_BATCH ];
-	CSEREAD *readB = new CSEREAD[ READS_PER_BATCH ];
-
-	register char *readA_data = new char[ MEM_SE_READSET ];
-	register char *readB_data = new char[ MEM_SE_READSET ];
-
-	for( register int i=0, j=0; i!=READS_PER_BATCH; ++i ) {
-		readA[i].id   = readA_data + j;
-		readB[i].id   = readB_data + j;
-		j += MAX_READ_ID;
-		readA[i].seq  = readA_data + j;
-		readB[i].seq  = readB_data + j;
-		j += MAX_READ_CYCLE;
-		readA[i].qual = readA_data + j;
-		readB[i].qual = readB_data + j;
-		j += MAX_READ_CYCLE;
+	// update in v1.7: 1 thread loads the reads into a ring of batches, and the others trim the
+	// pieces of the loaded batches; the threads live through the whole run (see pipeline.h)
+	// in split mode, the mapped input files are parsed by all the threads (see fq_split.h)
+	READ_PIPE pipe;
+	FQ_SPLIT *split = kp.use_mmap ? fq_split_open( kp.R1s, kp.thread ) : NULL;
+	pipe_init( &pipe, split ? kp.batches_in_flight : min( kp.batches_in_flight, BATCHES_IN_FLIGHT ), 1, kp.reads_per_batch,
+				kp.file_sample, nsample );
+	if( split )
+		pipe_split( &pipe, split, NULL, kp.R1s.size() );
+	for( unsigned int i=0; i!=pipe.nbatch; ++i ) {
+		pipe.batches[i].reads = new CSEREAD[ kp.reads_per_batch ];
+		arena_init( pipe.batches[i].arena, split ? 0 : arena_size( kp, kp.reads_per_batch ) );
 	}
 
-	CSEREAD *workingReads, *loadingReads, *swapReads;
-
 	ktrim_stat kstat;
-	kstat.dropped	   = new unsigned int [ kp.thread ];
-	kstat.real_adapter = new unsigned int [ kp.thread ];
-	kstat.tail_adapter = new unsigned int [ kp.thread ];
-	kstat.dimer	       = new unsigned int [ kp.thread ];
-	kstat.pass	       = new unsigned int [ kp.thread ];
+	unsigned int nstat = kp.thread * nsample;
+	kstat.dropped	   = new unsigned int [ nstat ];
+	kstat.real_adapter = new unsigned int [ nstat ];
+	kstat.tail_adapter = new unsigned int [ nstat ];
+	kstat.dimer	       = new unsigned int [ nstat ];
+	kstat.pass	       = new unsigned int [ nstat ];
 
 	// buffer for storing the modified reads per thread
+	// update in v1.7: each working thread could go a few pieces ahead of the writer (see fq_writer.h)
+	unsigned int threadCNT = split ? kp.thread : kp.thread - 1;
+	unsigned int nslot = threadCNT << 2;
 	writeBuffer writebuffer;
-	writebuffer.buffer1  = new char * [ kp.thread ];
-	writebuffer.b1stored = new unsigned int	[ kp.thread ];
+	writebuffer.buffer1  = new char * [ nslot ];
+	writebuffer.b1stored = new unsigned int	[ nslot ];
+	writebuffer.b1capacity = new unsigned int [ nslot ];
+
+	if( kp.gzip_output )
+		init_gz_wrbuffer( writebuffer, nslot, kp.piece_buffer_size, false, kp.bgzf_output );
+	if( kp.use_writev )
+		init_iov_wrbuffer( writebuffer, nslot );
 
-	for(unsigned int i=0; i!=kp.thread; ++i) {
-		writebuffer.buffer1[i]  = new char[ BUFFER_SIZE_PER_BATCH_READ ];
+	for(unsigned int i=0; i!=nslot; ++i) {
+		writebuffer.buffer1[i]  = new char[ kp.piece_buffer_size ];
 		writebuffer.b1stored[i] = 0;
+		writebuffer.b1capacity[i] = kp.piece_buffer_size;
+	}
+	OUT_QUEUE oq;
+	oq_open( &oq, &writebuffer, nslot, samples[0] );
 
+	for(unsigned int i=0; i!=nstat; ++i) {
 		kstat.dropped[i] = 0;
 		kstat.real_adapter[i] = 0;
 		kstat.tail_adapter[i] = 0;
@@ -189,134 +181,59 @@ int process_multi_thread_SE_C( const ktrim_param &kp ) {
 		kstat.pass[i]  = 0;
 	}
 
-	// deal with multiple input files
-//	vector<string> R1s;
-//	extractFileNames( kp.FASTQU, R1s );	//this is moved to param_handler
-	unsigned int totalFiles = kp.R1s.size();
-	//cout << "\033[1;34mINFO: " << totalFiles << " single-end fastq files will be loaded.\033[0m\n";
-
-	register unsigned int line = 0;
-	unsigned int threadCNT = kp.thread - 1;
-	for( unsigned int fileCnt=0; fileCnt!=totalFiles; ++ fileCnt ) {
-		bool file_is_gz = false;
-		FILE *fq;
-		gzFile gfp;
-		register unsigned int i = kp.R1s[fileCnt].size() - 3;
-		register const char * p = kp.R1s[fileCnt].c_str();
-		if( p[i]=='.' && p[i+1]=='g' && p[i+2]=='z' ) {
-			file_is_gz = true;
-			gfp = gzopen( p, "r" );
-			if( gfp == NULL ) {
-				cerr << "\033[1;31mError: open fastq file failed!\033[0m\n";
-				return 104;
-			}
+	omp_set_num_threads( kp.thread );
+	#pragma omp parallel
+	{
+		unsigned int tn = omp_get_thread_num();
+		if( tn == threadCNT ) {	// use 1 thread to load file (if not in split mode), others for trimming
+			pipe_reader( &pipe, &oq, 0, kp.R1s, kp.thread, kp );
 		} else {
-			fq = fopen( p, "rt" );
-			if( fq == NULL ) {
-				cerr << "\033[1;31mError: open fastq file failed!\033[0m\n";
-				return 104;
+			READ_BATCH *b;
+			unsigned int piece;
+			while( pipe_next_piece( &pipe, &oq, b, piece ) ) {
+				unsigned int start = piece_start( b->loaded[0], piece );
+				unsigned int end   = piece_start( b->loaded[0], piece+1 );
+				workingThread_SE_C( tn + b->sample*kp.thread, start, end, (CSEREAD *)b->reads, &kstat, &oq, b->seq+piece, kp );
+				pipe_piece_done( &pipe, b );
+				if( oq_failed( &oq ) )	// the error has been reported by the writers
+					pipe_abort( &pipe, 103 );
 			}
 		}
-		// initialization
-		// get first batch of fastq reads
-		unsigned int loaded;
-		bool metEOF;
-		if( file_is_gz ) {
-			loaded = load_batch_data_SE_GZ( gfp, readA, READS_PER_BATCH );
-			metEOF = gzeof( gfp );
-		} else {
-			loaded = load_batch_data_SE_C( fq, readA, READS_PER_BATCH );
-			metEOF = feof( fq );
-		}
-		if( loaded == 0 ) break;
-//		fprintf( stderr, "Loaded %d, metEOF=%d\n", loaded, metEOF );
-
-		loadingReads = readB;
-		workingReads = readA;
-		bool nextBatch = true;
-		unsigned int threadLoaded;
-		while( nextBatch ) {
-			// start parallalization
-			write_thread = 0;
-			omp_set_num_threads( kp.thread );
-			#pragma omp parallel
-			{
-				unsigned int tn = omp_get_thread_num();
-				// if EOF is met, then all threads are used for analysis
-				// otherwise 1 thread will do data loading
-				if( metEOF ) {
-					unsigned int start = loaded * tn / kp.thread;
-					unsigned int end   = loaded * (tn+1) / kp.thread;
-					workingThread_SE_C( tn, start, end, workingReads, &kstat, &writebuffer, kp );
-					nextBatch = false;
-				} else {	// use 1 thread to load file, others for trimming
-					if( tn == threadCNT ) {
-						if( file_is_gz ) {
-							threadLoaded = load_batch_data_SE_GZ( gfp, loadingReads, READS_PER_BATCH );
-							metEOF = gzeof( gfp );
-						} else {
-							threadLoaded = load_batch_data_SE_C( fq, loadingReads, READS_PER_BATCH );
-							metEOF = feof( fq );
-						}
-						nextBatch = (threadLoaded!=0);
-//						cerr << "Thread " << tn << " has loaded " << threadLoaded << " reads.\n";
-//						fprintf( stderr, "Loaded %d, metEOF=%d\n", threadLoaded, metEOF );
-						//cerr << "Loading thread: " << threadLoaded << ", " << metEOF << ", " << nextBatch << '\n';
-					} else {
-						unsigned int start = loaded * tn / threadCNT;
-						unsigned int end   = loaded * (tn+1) / threadCNT;
-						workingThread_SE_C( tn, start, end, workingReads, &kstat, &writebuffer, kp );
-						// write output; fwrite is thread-safe
-					}
-				}
-			} // parallel body
-			// swap workingReads and loadingReads for next loop
-			swapReads	= loadingReads;
-			loadingReads = workingReads;
-			workingReads = swapReads;
-			line += loaded;
-			loaded = threadLoaded;
-			//cerr << '\r' << line << " reads loaded";
-		}
-
-		if( file_is_gz ) {
-			gzclose( gfp );
-		} else {
-			fclose( fq );
+	} // parallel body
+
+	// update in v1.7: the buffers are also released on errors, and the reader has left its files
+	// to pipe_free (see pipe_reader)
+	if( pipe.error != 0 ) {
+		oq_abort( &oq );
+	} else if( ! oq_close( &oq ) ) {	// write the remaining pieces; the error has been reported by the writers
+		pipe.error = 103;
+	} else {
+		// write trim.log of each sample; the statistics of sample s are in [s*thread, (s+1)*thread)
+		for( unsigned int s=0; s!=nsample; ++s ) {
+			int dropped_all=0, real_all=0, tail_all=0, dimer_all=0, pass_all=0;
+			for( unsigned int i=s*kp.thread; i!=(s+1)*kp.thread; ++i ) {
+				dropped_all += kstat.dropped[i];
+				real_all  += kstat.real_adapter[i];
+				tail_all  += kstat.tail_adapter[i];
+				dimer_all += kstat.dimer[i];
+				pass_all  += kstat.pass[i];
+			}
+			fprintf( samples[s].flog, "Total\t%u\nDropped\t%u\nAadaptor\t%u\nTailHit\t%u\nDimer\t%u\nPass\t%u\n",
+						pipe.line[s], dropped_all, real_all, tail_all, dimer_all, pass_all );
 		}
 	}
-	//cerr << "\rDone: " << line << " lines processed.\n";
-
-	// write trim.log
-	int dropped_all=0, real_all=0, tail_all=0, dimer_all=0, pass_all=0;
-	for( unsigned int i=0; i!=kp.thread; ++i ) {
-		dropped_all += kstat.dropped[i];
-		real_all  += kstat.real_adapter[i];
-		tail_all  += kstat.tail_adapter[i];
-		dimer_all += kstat.dimer[i];
-		pass_all  += kstat.pass[i];
-	}
-	fprintf( kp.flog, "Total\t%u\nDropped\t%u\nAadaptor\t%u\nTailHit\t%u\nDimer\t%u\nPass\t%u\n",
-				line, dropped_all, real_all, tail_all, dimer_all, pass_all );
+	fq_split_close( split, kp.R1s.size() );
 
 	//free memory
-	for(unsigned int i=0; i!=kp.thread; ++i) {
-		delete writebuffer.buffer1[i];
+	free_kstat_wrbuffer( kstat, writebuffer, nslot, false, kp );
+	for( unsigned int i=0; i!=pipe.nbatch; ++i ) {
+		delete [] (CSEREAD *)pipe.batches[i].reads;
+		arena_free( pipe.batches[i].arena );
 	}
-	delete [] writebuffer.buffer1;
-
-	delete [] kstat.dropped;
-	delete [] kstat.real_adapter;
-	delete [] kstat.tail_adapter;
-	delete [] kstat.dimer;
-	delete [] kstat.pass;
-
-	delete [] readA;
-	delete [] readB;
-	delete [] readA_data;
-	delete [] readB_data;
+	register int retValue = pipe.error;
+	pipe_free( &pipe );
 
-	return 0;
+	return retValue;
 }
 
 int process_single_thread_SE_C( const ktrim_param &kp ) {
@@ -324,17 +241,10 @@ int process_single_thread_SE_C( const ktrim_param &kp ) {
 //	ios::sync_with_stdio( false );
 //	cin.tie( NULL );
 
-	CSEREAD *read = new CSEREAD[ READS_PER_BATCH_ST ];
-	register char *read_data = new char[ MEM_SE_READSET_ST ];
+	CSEREAD *read = new CSEREAD[ kp.reads_per_batch_st ];
+	READ_ARENA read_arena;
+	arena_init( &read_arena, arena_size( kp, kp.reads_per_batch_st ) );
 
-	for( register int i=0, j=0; i!=READS_PER_BATCH; ++i ) {
-		read[i].id   = read_data + j;
-		j += MAX_READ_ID;
-		read[i].seq  = read_data + j;
-		j += MAX_READ_CYCLE;
-		read[i].qual = read_data + j;
-		j += MAX_READ_CYCLE;
-	}
 
 	ktrim_stat kstat;
 	kstat.dropped	   = new unsigned int [ 1 ];
@@ -348,85 +258,96 @@ int process_single_thread_SE_C( const ktrim_param &kp ) {
 	kstat.dimer[0] = 0;
 	kstat.pass[0] = 0;
 
-	// buffer for storing the modified reads per thread
+	// buffer for storing the modified reads
+	// update in v1.7: 2 buffers are used, one is being written by the writer thread while the other is filled
+	const unsigned int nslot = 2;
 	writeBuffer writebuffer;
-	writebuffer.buffer1  = new char * [ 1 ];
-	writebuffer.b1stored = new unsigned int	[ 1 ];
-	writebuffer.buffer1[0] = new char[ BUFFER_SIZE_PER_BATCH_READ_ST ];
+	writebuffer.buffer1  = new char * [ nslot ];
+	writebuffer.b1stored = new unsigned int	[ nslot ];
+	writebuffer.b1capacity = new unsigned int [ nslot ];
+	for( unsigned int i=0; i!=nslot; ++i ) {
+		writebuffer.b1capacity[i] = kp.batch_buffer_size_st;
+		writebuffer.buffer1[i] = new char[ kp.batch_buffer_size_st ];
+	}
+	if( kp.gzip_output )
+		init_gz_wrbuffer( writebuffer, nslot, kp.batch_buffer_size_st, false, kp.bgzf_output );
+	if( kp.use_writev )
+		init_iov_wrbuffer( writebuffer, nslot );
+	OUT_QUEUE oq;
+	oq_open( &oq, &writebuffer, nslot, kp );
+
+	// update in v1.7: on errors, the loop stops with the exit code, and the files and buffers are
+	// released below as well
+	int retValue = 0;
 
 	// deal with multiple input files
 	unsigned int totalFiles = kp.R1s.size();
 	//cout << "\033[1;34mINFO: " << totalFiles << " single-end fastq files will be loaded.\033[0m\n";
 
+	// update in v1.7: the files are read ahead while trimming, and the next file is opened in advance
+	FQ_LIST fl;
+	fq_list_open( &fl, kp.R1s, kp.use_mmap, 1, kp.gz_index, true );
+
 	register unsigned int line = 0;
-	for( unsigned int fileCnt=0; fileCnt!=totalFiles; ++ fileCnt ) {
+	for( unsigned int fileCnt=0; retValue==0 && fileCnt!=totalFiles; ++ fileCnt ) {
 		//fq1.open( R1s[fileCnt].c_str() );
-		bool file_is_gz = false;
-		FILE *fq;
-		gzFile gfp;
-		register unsigned int i = kp.R1s[fileCnt].size() - 3;
-		register const char * p = kp.R1s[fileCnt].c_str();
-		if( p[i]=='.' && p[i+1]=='g' && p[i+2]=='z' ) {
-//			fprintf( stderr, "GZ file!\n" );
-			file_is_gz = true;
-			gfp = gzopen( p, "r" );
-			if( gfp == NULL ) {
-				cerr << "\033[1;31mError: open fastq file failed!\033[0m\n";
-				return 104;
-			}
-		} else {
-			fq = fopen( p, "rt" );
-			if( fq == NULL ) {
-				cerr << "\033[1;31mError: open fastq file failed!\033[0m\n";
-				return 104;
-			}
+		FQ_READER *fq;
+		bool failed;
+		fq = fq_list_next( &fl, failed );
+		if( failed ) {
+			cerr << "\033[1;31mError: open fastq file failed!\033[0m\n";
+			retValue = 104;
+			break;
 		}
 
 		while( true ) {
 			// get fastq reads
 			//unsigned int loaded = load_batch_data_SE( fq1, read, READS_PER_BATCH_ST );
 			unsigned int loaded;
-			if( file_is_gz ) {
-				loaded = load_batch_data_SE_GZ( gfp, read, READS_PER_BATCH_ST );
-//				fprintf( stderr, "Loaded=%d\n", loaded );
-			} else {
-				loaded = load_batch_data_SE_C( fq, read, READS_PER_BATCH_ST );
+			if( kp.use_writev )	// the reads may still be referred by the pending output
+				oq_wait( &oq, oq.next_seq );
+			loaded = load_batch_data_SE_C( fq, read, &read_arena, kp.reads_per_batch_st );
+			if( fq->error ) {	// the error has been reported by the reader
+				retValue = 107;
+				break;
 			}
 			if( loaded == 0 ) break;
 
-			write_thread = 0;
-			workingThread_SE_C( 0, 0, loaded, read, &kstat, &writebuffer, kp );
-			// write output and update fastq statistics
+			// update in v1.7: the output is written by the writer thread while the next batch is trimmed
+			workingThread_SE_C( 0, 0, loaded, read, &kstat, &oq, oq.next_seq++, kp );
 			line += loaded;
 			//cerr << '\r' << line << " reads loaded";
+			if( oq_failed( &oq ) ) {	// the error has been reported by the writers
+				retValue = 103;
+				break;
+			}
 
 			//if( fq1.eof() ) break;
 //			fprintf( stderr, "Check\n" );
-			if( file_is_gz ) {
-				if( gzeof( gfp ) ) break;
-			} else {
-				if( feof( fq ) ) break;
-			}
+			if( fq_reader_eof( fq ) ) break;
 		}
 		//fq1.close();
-		if( file_is_gz ) {
-			gzclose( gfp );
-		} else {
-			fclose( fq );
-		}
+		if( kp.use_writev )	// the output may refer to the mapped file
+			oq_wait( &oq, oq.next_seq );
+		fq_reader_close( fq );
+	}
+	fq_list_close( &fl );
+
+	if( retValue != 0 ) {
+		oq_abort( &oq );
+	} else if( ! oq_close( &oq ) ) {	// the error has been reported by the writers
+		retValue = 103;
+	} else {
+		// write trim.log
+		fprintf( kp.flog, "Total\t%u\nDropped\t%u\nAadaptor\t%u\nTailHit\t%u\nDimer\t%u\nPass\t%u\n",
+					line, kstat.dropped[0], kstat.real_adapter[0], kstat.tail_adapter[0], kstat.dimer[0], kstat.pass[0] );
 	}
-
-	// write trim.log
-	fprintf( kp.flog, "Total\t%u\nDropped\t%u\nAadaptor\t%u\nTailHit\t%u\nDimer\t%u\nPass\t%u\n",
-				line, kstat.dropped[0], kstat.real_adapter[0], kstat.tail_adapter[0], kstat.dimer[0], kstat.pass[0] );
 
 	//free memory
-//	delete buffer1;
-//	delete fq1buffer;
-	delete writebuffer.buffer1[0];
+	free_kstat_wrbuffer( kstat, writebuffer, nslot, false, kp );
 	delete [] read;
-	delete [] read_data;
+	arena_free( &read_arena );
 
-	return 0;
+	return retValue;
 }
 
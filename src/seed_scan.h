@@ -0,0 +1,199 @@
+/**
+ * Author: Ktrim contributors
+ * Date: Oct 2026
+ * Vectorized scan of the adapter index (i.e., the first 3 bases of the adapter) in the reads, and
+ * vectorized check of the seeds against the adapters
+ * This program is part of the Ktrim package
+**/
+
+/*
+ * update in v1.7: instead of calling memmem for each hit of the index and sorting the seeds, the
+ * positions of a read are scanned in blocks of SEED_BLOCK, and the hits of a block are returned as
+ * a bitmask (bit i for position pos+i): the bases at i, i+1 and i+2 are compared with the 3 bases
+ * of the index in 16 (SSE2), 32 (AVX2) or 64 (AVX-512) lanes at once
+ * for paired-end reads, the masks of read1 and read2 are merged by OR, so the seeds come out of the
+ * mask in order and without duplicates; the scan stops at the first block with a real adapter
+*/
+const unsigned int SEED_BLOCK = 64;
+
+#if defined(SIMD_USE_AVX2) && ! defined(SIMD_USE_AVX512)
+uint32_t inline seed_mask32( const char *p, const __m256i &c0, const __m256i &c1, const __m256i &c2 ) {
+	register __m256i m = _mm256_and_si256( _mm256_cmpeq_epi8( _mm256_loadu_si256((const __m256i *)p), c0 ),
+											_mm256_cmpeq_epi8( _mm256_loadu_si256((const __m256i *)(p+1)), c1 ) );
+	m = _mm256_and_si256( m, _mm256_cmpeq_epi8( _mm256_loadu_si256((const __m256i *)(p+2)), c2 ) );
+	return (uint32_t) _mm256_movemask_epi8( m );
+}
+#elif defined(SIMD_USE_SSE) && ! defined(SIMD_USE_AVX512)
+uint32_t inline seed_mask16( const char *p, const __m128i &c0, const __m128i &c1, const __m128i &c2 ) {
+	register __m128i m = _mm_and_si128( _mm_cmpeq_epi8( _mm_loadu_si128((const __m128i *)p), c0 ),
+										_mm_cmpeq_epi8( _mm_loadu_si128((const __m128i *)(p+1)), c1 ) );
+	m = _mm_and_si128( m, _mm_cmpeq_epi8( _mm_loadu_si128((const __m128i *)(p+2)), c2 ) );
+	return (uint32_t) _mm_movemask_epi8( m );
+}
+#endif
+
+/*
+ * hits of the index in positions [pos, pos+SEED_BLOCK) of seq (with n bases); only the positions where
+ * the whole index is within seq could be hits
+ * the vector code never reads beyond seq: the last block of a read is scanned by the scalar code
+*/
+uint64_t inline seed_mask( const char *seq, unsigned int n, const char *index, unsigned int pos ) {
+	if( pos + ADAPTER_INDEX_SIZE > n )
+		return 0;
+
+	register const char *p = seq + pos;
+	if( pos + SEED_BLOCK + ADAPTER_INDEX_SIZE - 1 <= n ) {
+#if defined(SIMD_USE_AVX512)
+		register __mmask64 m = _mm512_cmpeq_epi8_mask( _mm512_loadu_si512(p), _mm512_set1_epi8(index[0]) );
+		m &= _mm512_cmpeq_epi8_mask( _mm512_loadu_si512(p+1), _mm512_set1_epi8(index[1]) );
+		m &= _mm512_cmpeq_epi8_mask( _mm512_loadu_si512(p+2), _mm512_set1_epi8(index[2]) );
+		return (uint64_t) m;
+#elif defined(SIMD_USE_AVX2)
+		const __m256i c0 = _mm256_set1_epi8( index[0] );
+		const __m256i c1 = _mm256_set1_epi8( index[1] );
+		const __m256i c2 = _mm256_set1_epi8( index[2] );
+		return (uint64_t) seed_mask32( p, c0, c1, c2 ) | ((uint64_t) seed_mask32( p+32, c0, c1, c2 ) << 32);
+#elif defined(SIMD_USE_SSE)
+		const __m128i c0 = _mm_set1_epi8( index[0] );
+		const __m128i c1 = _mm_set1_epi8( index[1] );
+		const __m128i c2 = _mm_set1_epi8( index[2] );
+		return (uint64_t) seed_mask16( p,    c0, c1, c2 )        | ((uint64_t) seed_mask16( p+16, c0, c1, c2 ) << 16) |
+			  ((uint64_t) seed_mask16( p+32, c0, c1, c2 ) << 32) | ((uint64_t) seed_mask16( p+48, c0, c1, c2 ) << 48);
+#endif
+	}
+
+	register unsigned int m = n - pos - ADAPTER_INDEX_SIZE + 1;	// positions to check in this block
+	if( m > SEED_BLOCK )
+		m = SEED_BLOCK;
+	register uint64_t mask = 0;
+	for( register unsigned int i=0; i!=m; ++i ) {
+		if( p[i]==index[0] && p[i+1]==index[1] && p[i+2]==index[2] )
+			mask |= (uint64_t)1 << i;
+	}
+	return mask;
+}
+
+/*
+ * update in v1.7: the seeds are checked by comparing the read with the adapter (padded to
+ * MAX_ADAPTER_SIZE, see init_mismatch in util.h) in 64 (AVX-512), 32 (AVX2) or 16 (SSE2) lanes, and
+ * the mismatches are counted by popcount instead of a byte-by-byte loop
+ * AVX-512 masks the bytes beyond len in the load; otherwise, the vector code reads up to the next
+ * multiple of the vector width, which is done only if these bytes are on the same page as p[len-1]
+*/
+#if defined(SIMD_USE_AVX2) && ! defined(SIMD_USE_AVX512)
+const unsigned int MISMATCH_VECTOR = 32;
+#elif defined(SIMD_USE_SSE) && ! defined(SIMD_USE_AVX512)
+const unsigned int MISMATCH_VECTOR = 16;
+#endif
+const uintptr_t MISMATCH_PAGE = 4096;
+
+/*
+ * number of mismatches between p[0, len) and the adapter, where 0 < len <= MAX_ADAPTER_SIZE
+ * the scalar code stops counting at max+1, as the seed is rejected anyway
+*/
+unsigned int inline count_mismatch( const char *p, const char *adapter, unsigned int len, unsigned int max ) {
+#if defined(SIMD_USE_AVX512)
+	register uint64_t valid = ( len == 64 ) ? ~(uint64_t)0 : ((uint64_t)1 << len) - 1;
+	register __mmask64 eq = _mm512_cmpeq_epi8_mask( _mm512_maskz_loadu_epi8( valid, p ), _mm512_loadu_si512( adapter ) );
+	return __builtin_popcountll( ~eq & valid );
+#else
+#if defined(SIMD_USE_AVX2) || defined(SIMD_USE_SSE)
+	register const char *last = p + ((len + MISMATCH_VECTOR - 1) & ~(MISMATCH_VECTOR - 1)) - 1;
+	if( ((uintptr_t)(p + len - 1) & ~(MISMATCH_PAGE - 1)) == ((uintptr_t)last & ~(MISMATCH_PAGE - 1)) ) {
+		register uint64_t valid = ( len == 64 ) ? ~(uint64_t)0 : ((uint64_t)1 << len) - 1;
+		register uint64_t eq = 0;
+		for( register unsigned int i=0; i<len; i+=MISMATCH_VECTOR ) {
+#if defined(SIMD_USE_AVX2)
+			eq |= (uint64_t)(uint32_t) _mm256_movemask_epi8( _mm256_cmpeq_epi8( _mm256_loadu_si256((const __m256i *)(p+i)),
+																				_mm256_loadu_si256((const __m256i *)(adapter+i)) ) ) << i;
+#else
+			eq |= (uint64_t) _mm_movemask_epi8( _mm_cmpeq_epi8( _mm_loadu_si128((const __m128i *)(p+i)),
+																_mm_loadu_si128((const __m128i *)(adapter+i)) ) ) << i;
+#endif
+		}
+		return __builtin_popcountll( ~eq & valid );
+	}
+#endif
+	register unsigned int i, mis = 0;
+	for( i=0; i!=len; ++i ) {
+		if( p[i] != adapter[i] && ++mis > max )
+			break;
+	}
+	return mis;
+#endif
+}
+
+/*
+ * use dynamic max_mismatch as the covered size can range from 3 to a large number such as 50,
+ * here the maximum mismatch allowed is LEN/8
+*/
+bool check_mismatch_dynamic_SE_C( const CSEREAD *read, unsigned int pos, const ktrim_param & kp ) {
+	register unsigned int len;
+	len = read->size - pos;
+	if( len > kp.adapter_len )
+		len = kp.adapter_len;
+
+	register unsigned int max_mismatch_dynamic = kp.max_mismatch[len];
+	return count_mismatch( read->seq + pos, kp.adapter_pad1, len, max_mismatch_dynamic ) <= max_mismatch_dynamic;
+}
+
+/*
+ * use dynamic max_mismatch as the covered size can range from 3 to a large number such as 50,
+ * here the maximum mismatch allowed is LEN/4 for read1 + read2
+ * update in v1.7: both reads are compared with vector instructions, see count_mismatch
+*/
+bool check_mismatch_dynamic_PE_C( const CPEREAD *read, unsigned int pos, const ktrim_param &kp ) {
+	register unsigned int len;
+	len = read->size - pos;
+	if( len > kp.adapter_len )
+		len = kp.adapter_len;
+
+	register unsigned int max_mismatch_dynamic = kp.max_mismatch[len];
+	return count_mismatch( read->seq1 + pos, kp.adapter_pad1, len, max_mismatch_dynamic ) <= max_mismatch_dynamic &&
+		   count_mismatch( read->seq2 + pos, kp.adapter_pad2, len, max_mismatch_dynamic ) <= max_mismatch_dynamic;
+}
+
+/*
+ * update in v1.7: look for the adapter with the seed masks (see seed_mask) instead of collecting and
+ * sorting the seeds; a seed is a hit of index1 at pos or a hit of index3 at pos+OFFSET_INDEX3
+ * with '--indel', the seeds failing the mismatch check are checked by the edit distance (see myers.h)
+ * returns the position of the adapter, or -1 if there is none
+*/
+int find_adapter_se( const CSEREAD *read, const ktrim_param &kp ) {
+	register uint64_t hits;
+	register unsigned int pos, s;
+	for( pos=0; pos < read->size; pos += SEED_BLOCK ) {
+		hits = seed_mask( read->seq, read->size, kp.adapter_index1, pos );
+		if( read->size > OFFSET_INDEX3 )
+			hits |= seed_mask( read->seq + OFFSET_INDEX3, read->size - OFFSET_INDEX3, kp.adapter_index3, pos );
+		while( hits ) {
+			s = pos + __builtin_ctzll( hits );
+			if( check_mismatch_dynamic_SE_C( read, s, kp ) || (kp.use_indel && check_edit_distance_SE( read, s, kp )) )
+				return s;
+			hits &= hits - 1;
+		}
+	}
+	return -1;
+}
+
+/*
+ * update in v1.7: look for the adapter with the seed masks of seq1 and seq2, the seeds of both reads are
+ * checked in ascending order of their positions; with '--indel', the seeds failing the mismatch check
+ * are checked by the edit distance (see myers.h)
+ * returns the position of the adapter, or -1 if there is none
+*/
+int find_adapter_pe( const CPEREAD *read, const ktrim_param &kp ) {
+	register uint64_t hits;
+	register unsigned int pos, s;
+	for( pos=0; pos < read->size; pos += SEED_BLOCK ) {
+		hits = seed_mask( read->seq1, read->size, kp.adapter_index1, pos ) |
+			   seed_mask( read->seq2, read->size, kp.adapter_index2, pos );
+		while( hits ) {
+			s = pos + __builtin_ctzll( hits );
+			if( check_mismatch_dynamic_PE_C( read, s, kp ) || (kp.use_indel && check_edit_distance_PE( read, s, kp )) )
+				return s;
+			hits &= hits - 1;
+		}
+	}
+	return -1;
+}
@@ -0,0 +1,355 @@
+/**
+ * Author: Ktrim contributors
+ * Date: Oct 2026
+ * Server mode: a long-running Ktrim process that trims the jobs sent over a Unix domain socket
+ * This program is part of the Ktrim package
+**/
+
+#ifndef _KTRIM_SERVER_
+#define _KTRIM_SERVER_
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <ctime>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <memory.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <malloc.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <omp.h>
+#include "common.h"
+#include "util.h"
+
+using namespace std;
+
+/*
+ * update in v1.7: for many small jobs (e.g., a sample sheet processed by a workflow manager), most of
+ * the running time of a Ktrim process goes to starting the threads and faulting in the buffers
+ * in server mode ('--server socket'), Ktrim runs the jobs sent to the socket one after another in the
+ * same process, therefore the OpenMP threads are started only once; malloc is also asked to keep the
+ * freed memory in the heap, which saves some page faults for the next job but is not guaranteed
+ *
+ * the client ('--connect socket') sends all its other options as the job, together with its current
+ * directory, stdout and stderr (as file descriptors); the server runs the job in that directory with
+ * these stdout and stderr, i.e., the job behaves the same as a normal Ktrim run (including '-c'),
+ * then the exit code and the contents of trim.log are sent back to the client
+ *
+ * request: uint32 size of the options (with the 3 descriptors attached), then the options as
+ *          NUL-terminated strings (the first one is the program name)
+ * reply  : int32 exit code, uint32 size of the statistics, then the statistics
+*/
+
+static const char *server_socket_path = NULL;
+
+void server_quit( int sig ) {
+	unlink( server_socket_path );
+	_exit( 0 );
+}
+
+bool read_all( int fd, void *buf, size_t size ) {
+	register char *p = (char *) buf;
+	while( size ) {
+		register ssize_t n = read( fd, p, size );
+		if( n <= 0 ) {
+			if( n < 0 && errno == EINTR )
+				continue;
+			return false;
+		}
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+bool write_all( int fd, const void *buf, size_t size ) {
+	register const char *p = (const char *) buf;
+	while( size ) {
+		register ssize_t n = write( fd, p, size );
+		if( n < 0 ) {
+			if( errno == EINTR )
+				continue;
+			return false;
+		}
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+// returns -1 if the path is too long for a Unix domain socket
+int make_socket_addr( const char *path, struct sockaddr_un *addr ) {
+	if( strlen(path) >= sizeof(addr->sun_path) ) {
+		cerr << "\033[1;31mError: the socket path is too long!\033[0m\n";
+		return -1;
+	}
+	memset( addr, 0, sizeof(struct sockaddr_un) );
+	addr->sun_family = AF_UNIX;
+	strcpy( addr->sun_path, path );
+	return 0;
+}
+
+// the contents of the trim.log files of the job
+void load_job_stat( const ktrim_param &kp, string &stat ) {
+	vector<string> prefixes;
+	if( kp.samplelist != NULL )
+		prefixes = kp.outpres;
+	else
+		prefixes.push_back( kp.outpre );
+
+	for( unsigned int i=0; i!=prefixes.size(); ++i ) {
+		string fileName = prefixes[i] + ".trim.log";
+		ifstream fin( fileName.c_str() );
+		if( fin.fail() )
+			continue;
+		stringstream ss;
+		ss << fin.rdbuf();
+		if( prefixes.size() > 1 )
+			stat += "# " + prefixes[i] + '\n';
+		stat += ss.str();
+	}
+}
+
+/*
+ * run a job in the current directory, as if it were the command line of a normal Ktrim run
+ * the statistics are loaded into stat if the job succeeds
+*/
+int run_job( int argc, char *argv[], string &stat ) {
+	ktrim_param *kp = new ktrim_param();
+	init_param( *kp );
+	optind = 0;		// re-initialize getopt_long for the new job
+
+	// the errors are returned as exit codes, and the files and buffers of the job are released
+	// by the functions that fail (see process_cmd_param and the handlers)
+	int retValue = process_cmd_param( argc, argv, *kp );
+	if( retValue == 0 && (kp->server_socket != NULL || kp->connect_socket != NULL) ) {
+		cerr << "\033[1;31mError: '--server'/'--connect' could not be used in a job!\033[0m\n";
+		if( kp->samplelist == NULL )	// the output files of the samples are not opened yet
+			close_files( *kp );
+		retValue = 2;
+	} else if( retValue == 0 ) {
+		retValue = trim_files( *kp );
+		if( retValue == 0 )
+			load_job_stat( *kp, stat );
+	} else if( retValue == 100 ) {	// help or version
+		retValue = 0;
+	}
+
+	delete kp;
+	return retValue;
+}
+
+/*
+ * receive a job from the client and run it
+ * fds: the current directory, stdout and stderr of the client
+*/
+int serve_job( int cfd, int home, unsigned int jobCnt ) {
+	uint32_t size;
+	int fds[3];
+	struct iovec iov;
+	iov.iov_base = &size;
+	iov.iov_len  = sizeof(uint32_t);
+	char control[ CMSG_SPACE(sizeof(fds)) ];
+	struct msghdr msg;
+	memset( &msg, 0, sizeof(msg) );
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	if( recvmsg( cfd, &msg, MSG_WAITALL ) != sizeof(uint32_t) )
+		return -1;
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR( &msg );
+	if( cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+			cmsg->cmsg_len != CMSG_LEN(sizeof(fds)) )
+		return -1;
+	memcpy( fds, CMSG_DATA(cmsg), sizeof(fds) );
+
+	int retValue = -1;
+	char *request = NULL;
+	if( size != 0 && size <= SERVER_MAX_REQUEST ) {
+		request = new char[ size + 1 ];
+		if( read_all( cfd, request, size ) ) {
+			request[ size ] = '\0';
+			retValue = 0;
+		}
+	}
+	if( retValue != 0 ) {
+		delete [] request;
+		close( fds[0] ); close( fds[1] ); close( fds[2] );
+		return -1;
+	}
+
+	vector<char *> args;
+	for( register char *p = request; p < request + size; p += strlen(p) + 1 )
+		args.push_back( p );
+	args.push_back( NULL );
+
+	// run the job in the directory of the client, with its stdout and stderr
+	cout.flush();
+	fflush( stdout );
+	int out = dup( 1 ), err = dup( 2 );
+	dup2( fds[1], 1 );
+	dup2( fds[2], 2 );
+	string stat;
+	clock_t start = clock();
+	time_t wall = time( NULL );
+	if( fchdir( fds[0] ) == 0 ) {
+		retValue = run_job( args.size() - 1, &args[0], stat );
+	} else {
+		cerr << "\033[1;31mError: cannot enter the working directory!\033[0m\n";
+		retValue = 104;
+	}
+	cout.flush();
+	fflush( stdout );
+	dup2( out, 1 );
+	dup2( err, 2 );
+	close( out ); close( err );
+	fchdir( home );
+	close( fds[0] ); close( fds[1] ); close( fds[2] );
+	delete [] request;
+
+	cerr << "Job " << jobCnt << " done: exit code " << retValue << ", " << time(NULL) - wall << " s ("
+		 << (double)(clock() - start) / CLOCKS_PER_SEC << " s CPU time).\n";
+
+	int32_t code = retValue;
+	size = stat.size();
+	if( ! write_all( cfd, &code, sizeof(int32_t) ) || ! write_all( cfd, &size, sizeof(uint32_t) ) ||
+			! write_all( cfd, stat.c_str(), stat.size() ) )
+		return -1;
+	return 0;
+}
+
+// run the server on the socket until it is killed (SIGINT or SIGTERM)
+int run_server( const char *path ) {
+	struct sockaddr_un addr;
+	if( make_socket_addr( path, &addr ) != 0 )
+		return 106;
+	int sfd = socket( AF_UNIX, SOCK_STREAM, 0 );
+	unlink( path );
+	if( sfd < 0 || bind( sfd, (struct sockaddr *) &addr, sizeof(addr) ) != 0 || listen( sfd, SERVER_BACKLOG ) != 0 ) {
+		cerr << "\033[1;31mError: cannot listen on socket " << path << "!\033[0m\n";
+		return 106;
+	}
+	server_socket_path = path;
+	signal( SIGINT,  server_quit );
+	signal( SIGTERM, server_quit );
+	signal( SIGPIPE, SIG_IGN );		// the client may quit before its job is done
+
+	// ask malloc to keep the freed memory in the heap for the next job: the batches are larger than
+	// the mmap threshold, and would be returned to the system on free
+	mallopt( M_MMAP_MAX, 0 );
+	mallopt( M_TRIM_THRESHOLD, INT_MAX );
+
+	// '-t 0' of each job uses all the threads, while the jobs change the OpenMP setting
+	int max_thread = omp_get_max_threads();
+	int home = open( ".", O_RDONLY );
+	cerr << "\033[1;32mKtrim server is listening on " << path << "\033[0m\n";
+
+	for( unsigned int jobCnt=1; ; ) {
+		int cfd = accept( sfd, NULL, NULL );
+		if( cfd < 0 )
+			continue;
+		omp_set_num_threads( max_thread );
+		if( serve_job( cfd, home, jobCnt ) == 0 )
+			++ jobCnt;
+		else
+			cerr << "\033[1;31mError: invalid job request!\033[0m\n";
+		close( cfd );
+	}
+	return 0;
+}
+
+// whether arg is '--connect' (or its abbreviation), with or without '=socket'
+bool is_connect_option( const char *arg, bool &has_value ) {
+	if( arg[0] != '-' || arg[1] != '-' )
+		return false;
+	arg += 2;
+	const char *eq = strchr( arg, '=' );
+	size_t n = eq ? eq - arg : strlen( arg );
+	has_value = ( eq != NULL );
+	return n != 0 && n <= 7 && strncmp( arg, "connect", n ) == 0;
+}
+
+// send the job (all the options except '--connect') to the server and wait for it
+int run_client( const char *path, int argc, char *argv[] ) {
+	string request;
+	bool has_value;
+	for( int i=0; i!=argc; ++i ) {
+		if( i && is_connect_option( argv[i], has_value ) ) {
+			if( ! has_value )
+				++ i;
+			continue;
+		}
+		request += argv[i];
+		request += '\0';
+	}
+	if( request.size() > SERVER_MAX_REQUEST ) {
+		cerr << "\033[1;31mError: too many options for a job!\033[0m\n";
+		return 106;
+	}
+
+	struct sockaddr_un addr;
+	if( make_socket_addr( path, &addr ) != 0 )
+		return 106;
+	int cfd = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if( cfd < 0 || connect( cfd, (struct sockaddr *) &addr, sizeof(addr) ) != 0 ) {
+		cerr << "\033[1;31mError: cannot connect to the server on socket " << path << "!\033[0m\n";
+		return 106;
+	}
+
+	int fds[3];
+	fds[0] = open( ".", O_RDONLY );
+	fds[1] = 1;
+	fds[2] = 2;
+	if( fds[0] < 0 ) {
+		cerr << "\033[1;31mError: cannot open the working directory!\033[0m\n";
+		close( cfd );
+		return 104;
+	}
+
+	uint32_t size = request.size();
+	struct iovec iov;
+	iov.iov_base = &size;
+	iov.iov_len  = sizeof(uint32_t);
+	char control[ CMSG_SPACE(sizeof(fds)) ];
+	memset( control, 0, sizeof(control) );
+	struct msghdr msg;
+	memset( &msg, 0, sizeof(msg) );
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR( &msg );
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type  = SCM_RIGHTS;
+	cmsg->cmsg_len   = CMSG_LEN( sizeof(fds) );
+	memcpy( CMSG_DATA(cmsg), fds, sizeof(fds) );
+
+	int32_t code;
+	bool ok = sendmsg( cfd, &msg, 0 ) == sizeof(uint32_t) && write_all( cfd, request.c_str(), request.size() ) &&
+				read_all( cfd, &code, sizeof(int32_t) ) && read_all( cfd, &size, sizeof(uint32_t) );
+	close( fds[0] );
+	if( ! ok ) {
+		cerr << "\033[1;31mError: the job is not done by the server!\033[0m\n";
+		close( cfd );
+		return 106;
+	}
+
+	// report the statistics
+	char *stat = new char[ size + 1 ];
+	if( read_all( cfd, stat, size ) )
+		write_all( 2, stat, size );
+	delete [] stat;
+	close( cfd );
+	return code;
+}
+
+#endif
@@ -0,0 +1,160 @@
+/**
+ * Author: Ktrim contributors
+ * Date: Oct 2026
+ * Runtime dispatch of the vectorized kernels by the instruction sets of the CPU
+ * This program is part of the Ktrim package
+**/
+
+#ifndef _KTRIM_SIMD_
+#define _KTRIM_SIMD_
+
+#include <stdint.h>
+#include <memory.h>
+#include "common.h"
+
+/*
+ * update in v1.7: Ktrim used to be compiled with -march=native, so the binary only ran on CPUs like the
+ * one it was built on, and a generic build got no vector code at all; now the hot kernels (seed scan,
+ * mismatch check, quality windows, bit-parallel and edit-distance matchers) are compiled once for each
+ * instruction set by including their headers in a namespace under '#pragma GCC target', and the best
+ * set supported by the CPU is chosen at startup via cpuid (or forced by '--simd' for benchmarking)
+ * the output formatting is left to memcpy, which glibc already dispatches by the CPU
+ *
+ * therefore the kernel headers (myers.h, seed_scan.h, qual_scan.h and bitpar.h) have no include guard,
+ * and SIMD_USE_AVX512, SIMD_USE_AVX2 and SIMD_USE_SSE are defined here for the instruction set being
+ * compiled; the SSE level only uses SSE2, which every x86-64 CPU has
+*/
+enum { SIMD_LEVEL_SCALAR = 0, SIMD_LEVEL_SSE2, SIMD_LEVEL_AVX2, SIMD_LEVEL_AVX512, SIMD_LEVEL_NUM };
+const int SIMD_LEVEL_AUTO = -1;
+const char * const SIMD_LEVEL_NAME[ SIMD_LEVEL_NUM ] = { "scalar", "sse2", "avx2", "avx512" };
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace simd_scalar {
+#include "myers.h"
+#include "seed_scan.h"
+#include "qual_scan.h"
+#include "bitpar.h"
+}
+
+#ifdef SIMD_X86
+#define SIMD_USE_SSE
+#pragma GCC push_options
+#pragma GCC target("sse2")
+namespace simd_sse2 {
+#include "myers.h"
+#include "seed_scan.h"
+#include "qual_scan.h"
+#include "bitpar.h"
+}
+#pragma GCC pop_options
+
+#define SIMD_USE_AVX2
+#pragma GCC push_options
+#pragma GCC target("avx2,popcnt")
+namespace simd_avx2 {
+#include "myers.h"
+#include "seed_scan.h"
+#include "qual_scan.h"
+#include "bitpar.h"
+}
+#pragma GCC pop_options
+
+#define SIMD_USE_AVX512
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw,avx2,popcnt")
+namespace simd_avx512 {
+#include "myers.h"
+#include "seed_scan.h"
+#include "qual_scan.h"
+#include "bitpar.h"
+}
+#pragma GCC pop_options
+
+#undef SIMD_USE_SSE
+#undef SIMD_USE_AVX2
+#undef SIMD_USE_AVX512
+#endif
+
+// the entries of the kernels called by the working threads
+typedef struct {
+	int (*find_adapter_pe)( const CPEREAD *read, const ktrim_param &kp );
+	int (*find_adapter_se)( const CSEREAD *read, const ktrim_param &kp );
+	int (*bitpar_find_adapter_pe)( const CPEREAD *read, BITPAR_READ *br, const ktrim_param &kp );
+	int (*bitpar_find_adapter_se)( const CSEREAD *read, BITPAR_READ *br, const ktrim_param &kp );
+	int (*get_quality_trim_cycle_pe)( const CPEREAD *read, const ktrim_param &kp );
+	int (*get_quality_trim_cycle_se)( const char *p, const int total_size, const ktrim_param &kp );
+} SIMD_KERNELS;
+
+#define SIMD_KERNELS_OF( ns ) { ns::find_adapter_pe, ns::find_adapter_se, ns::bitpar_find_adapter_pe, \
+								ns::bitpar_find_adapter_se, ns::get_quality_trim_cycle_pe, ns::get_quality_trim_cycle_se }
+
+const SIMD_KERNELS simd_kernel_list[] = {
+	SIMD_KERNELS_OF( simd_scalar ),
+#ifdef SIMD_X86
+	SIMD_KERNELS_OF( simd_sse2 ),
+	SIMD_KERNELS_OF( simd_avx2 ),
+	SIMD_KERNELS_OF( simd_avx512 ),
+#endif
+};
+
+// the kernels in use, set by simd_select
+SIMD_KERNELS simd = SIMD_KERNELS_OF( simd_scalar );
+
+// the best level supported by the CPU (and the OS, for the AVX registers)
+int simd_detect() {
+#ifdef SIMD_X86
+	__builtin_cpu_init();
+	if( __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("popcnt") )
+		return SIMD_LEVEL_AVX512;
+	if( __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt") )
+		return SIMD_LEVEL_AVX2;
+	if( __builtin_cpu_supports("sse2") )	// always true on x86-64
+		return SIMD_LEVEL_SSE2;
+#endif
+	return SIMD_LEVEL_SCALAR;
+}
+
+// the level of a name, or -1 for an unknown name
+int simd_parse_level( const char *name ) {
+	for( register int i=0; i!=SIMD_LEVEL_NUM; ++i )
+		if( strcmp( name, SIMD_LEVEL_NAME[i] ) == 0 )
+			return i;
+	return -1;
+}
+
+// use the kernels of a level, which must be supported by the CPU (see simd_detect)
+void simd_select( int level ) {
+	simd = simd_kernel_list[ level ];
+}
+
+// bit-planes of a read for '--bitpar'
+void bitpar_init( BITPAR_READ *br ) {
+	br->lo = br->hi = br->n = NULL;
+	br->capacity = 0;
+}
+
+void bitpar_free( BITPAR_READ *br ) {
+	delete [] br->lo;
+	bitpar_init( br );
+}
+
+// the planes of the adapter (at most 64 bases, see MAX_ADAPTER_SIZE)
+void bitpar_encode_adapter( const char *adapter, unsigned int len, uint64_t *bits ) {
+	simd_scalar::bitpar_encode64( adapter, len, bits[0], bits[1], bits[2] );
+}
+
+// Peq[c] for '--indel': bit i is set if base i of the adapter is c; indexed by the code of the base, see myers_eq
+void myers_init_adapter( const char *adapter, unsigned int len, uint64_t *peq ) {
+	peq[0] = peq[1] = peq[2] = peq[3] = 0;
+	for( register unsigned int i=0; i!=len; ++i ) {
+		register unsigned int code = (adapter[i] >> 1) & 3;
+		if( adapter[i] == "ACTG"[code] )
+			peq[code] |= (uint64_t)1 << i;
+	}
+}
+
+#endif
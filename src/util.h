@@ -16,10 +16,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <memory.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
 #include <omp.h>
 #include <math.h>
 #include <zlib.h>
 #include "common.h"
+#include "fq_reader.h"
+#include "simd.h"
 
 using namespace std;
 
@@ -38,12 +44,16 @@ void extractFileNames( const char *str, vector<string> & Rs ) {
 		Rs.push_back( fileName );
 }
 
-void loadFQFileNames( ktrim_param & kp ) {
+/*
+ * update in v1.7: returns the exit code instead of exiting, as the errors only stop the current job in
+ * server mode (see server.h); 0 for success
+*/
+int loadFQFileNames( ktrim_param & kp ) {
 	ifstream fin;
 	fin.open( kp.filelist );
 	if( fin.fail() ) {
 		cerr << "Error: load file " << kp.filelist << " failed!\n";
-		exit(10);
+		return 10;
 	}
 
 	string line;
@@ -115,320 +125,537 @@ void loadFQFileNames( ktrim_param & kp ) {
 	fin.close();
 	if( inconsistent ) {
 		cerr << "\033[1;31mERROR: inconsistent PE/SE in '" << kp.filelist << "'!\033[0m\n";
-		exit(3);
+		return 3;
 	}
 	if( pe_data ) {
 		if( kp.R1s.size() != kp.R2s.size() ) {
 			cerr << "\033[1;31mError: incorrect pairs in file list!\033[0m\n";
-			exit(110);
+			return 110;
 		}
 	}
 //	cerr << "Done: " << lineCnt << " lines of " << (pe_data) ? 'P' : 'S' << "E data loaded.\n";
 	kp.paired_end_data = pe_data;
+	return 0;
 }
 
-//load 1 batch of data, using purely C-style
-unsigned int load_batch_data_SE_C( FILE *fp, CSEREAD *loadingReads, unsigned int num ) {
-	register unsigned int loaded = 0;
-	register CSEREAD *p = loadingReads;
-	register CSEREAD *q = p + num;
-	while( p != q ) {
-		if( fgets( p->id, MAX_READ_ID,  fp ) == NULL ) break;
-		fgets( p->seq,  MAX_READ_CYCLE, fp );
-		fgets( p->qual, MAX_READ_CYCLE, fp );	// this line is useless
-		fgets( p->qual, MAX_READ_CYCLE, fp );
+/*
+ * update in v1.7: load the sample list for multi-sample mode
+ * each line is "out.prefix read1.fq[,read1.fq...] [read2.fq[,read2.fq...]]" (separated by spaces or tabs)
+ * all the input files are put into R1s/R2s, and file_sample records the sample of each file
+ * returns the exit code, 0 for success
+*/
+int loadSampleList( ktrim_param & kp ) {
+	ifstream fin;
+	fin.open( kp.samplelist );
+	if( fin.fail() ) {
+		cerr << "Error: load file " << kp.samplelist << " failed!\n";
+		return 10;
+	}
 
-		// remove the tail '\n'
-		register unsigned int i = strlen( p->seq ) - 1;
-		p->size = i;
-		p->seq[i]  = 0;
-		p->qual[i] = 0;
+	string line;
+	stringstream ss;
+	string pre, fq1, fq2;
+	vector<string> R1s, R2s;
+	bool inconsistent = false;
+	while( true ) {
+		getline(fin, line);
+		if( fin.eof() && line.empty() )break;
 
-		++ p;
+		if( line.empty() || line[0] == '#' ) {	// lines starts with "#" are ignored as comments
+			continue;
+		}
+
+		ss.str( line );
+		ss.clear();
+		fq1.clear();
+		fq2.clear();
+		ss >> pre >> fq1 >> fq2;
+		if( fq1.empty() ) {
+			inconsistent = true;
+			break;
+		}
+
+		R1s.clear();
+		R2s.clear();
+		extractFileNames( fq1.c_str(), R1s );
+		if( kp.outpres.empty() ) {
+			kp.paired_end_data = ! fq2.empty();
+		} else if( kp.paired_end_data == fq2.empty() ) {
+			inconsistent = true;
+			break;
+		}
+		if( kp.paired_end_data ) {
+			extractFileNames( fq2.c_str(), R2s );
+			if( R1s.size() != R2s.size() ) {
+				cerr << "\033[1;31mError: incorrect pairs for sample '" << pre << "'!\033[0m\n";
+				fin.close();
+				return 110;
+			}
+		}
+
+		for( unsigned int i=0; i!=R1s.size(); ++i ) {
+			kp.R1s.push_back( R1s[i] );
+			if( kp.paired_end_data )
+				kp.R2s.push_back( R2s[i] );
+			kp.file_sample.push_back( kp.outpres.size() );
+		}
+		kp.outpres.push_back( pre );
 	}
-	return p-loadingReads;
+
+	fin.close();
+	if( inconsistent ) {
+		cerr << "\033[1;31mERROR: inconsistent PE/SE in '" << kp.samplelist << "'!\033[0m\n";
+		return 3;
+	}
+	if( kp.outpres.empty() ) {
+		cerr << "\033[1;31mError: no sample in '" << kp.samplelist << "'!\033[0m\n";
+		return 3;
+	}
+	return 0;
 }
 
-// update in v1.2: support Gzipped input file
-unsigned int load_batch_data_SE_GZ( gzFile gfp, CSEREAD *loadingReads, unsigned int num ) {
-	register unsigned int loaded = 0;
-//	string unk;
-	register CSEREAD *p = loadingReads;
-	register CSEREAD *q = p + num;
-	register char c;
-	register unsigned int i;
+// update in v1.7: parse a memory size such as "4G", "512M" or "800K"; a plain number is in MB
+bool parse_memory_size( const char *str, unsigned long &size ) {
+	char *end;
+	double v = strtod( str, &end );
+	if( end == str || v <= 0 )
+		return false;
+
+	unsigned long unit = 1UL << 20;
+	switch( *end ) {
+		case 'k': case 'K': unit = 1UL << 10; ++ end; break;
+		case 'm': case 'M': ++ end; break;
+		case 'g': case 'G': unit = 1UL << 30; ++ end; break;
+		case 't': case 'T': unit = 1UL << 40; ++ end; break;
+	}
+	if( *end == 'b' || *end == 'B' )
+		++ end;
+	if( *end != '\0' )
+		return false;
 
-	while( p != q ) {
-		if( gzgets( gfp, p->id, MAX_READ_ID ) == NULL ) break;
-		gzgets( gfp, p->seq,  MAX_READ_CYCLE );
-		gzgets( gfp, p->qual, MAX_READ_CYCLE );	// this line is useless
-		gzgets( gfp, p->qual, MAX_READ_CYCLE );
+	size = v * unit;
+	return true;
+}
 
-		// remove the tailing '\n'
-		i = strlen( p->seq ) - 1;
-		p->size = i;
-		p->seq[i]  = 0;
-		p->qual[i] = 0;
+/*
+ * mean size of the records (with their 4 line ends) in the first TUNE_SAMPLE_READS reads of the file,
+ * plus 1/8 for variable-length reads; 0 if there is none
+ * the mean is used instead of the maximum, so that a few long reads do not inflate all the buffers
+ * only regular files are sampled: the reads taken from a pipe, a FIFO or a process substitution
+ * would be lost to the real reader, so 0 is returned for them and the default sizes are used
+*/
+unsigned int sample_record_size( const string &file ) {
+	struct stat st;
+	if( stat( file.c_str(), &st ) != 0 || ! S_ISREG( st.st_mode ) )
+		return 0;
 
-		++ p;
-	}
+	FQ_READER *fr = fq_reader_open( file.c_str(), false, 1, false );
+	if( fr == NULL )
+		return 0;
 
-	return p-loadingReads;
+	FQ_RECORD rec;
+	register unsigned long total = 0;
+	register unsigned int n;
+	for( n=0; n!=TUNE_SAMPLE_READS && fq_reader_next( fr, &rec ); ++n )
+		total += rec.id_len + rec.seq_len + rec.qual_len + 4;
+	fq_reader_close( fr );
+	if( n == 0 )
+		return 0;
+
+	total = (total + n - 1) / n;
+	return total + (total >> 3);
 }
 
-unsigned int load_batch_data_PE_C( FILE *fq, CPEREAD *loadingReads, const unsigned int num, const bool isRead1 ) {
-	//register unsigned int loaded = 0;
-	register CPEREAD *p = loadingReads;
-	register CPEREAD *q = p + num;
-	// load read1
-	if( isRead1 ) {
-		while( p != q ) {
-			if( fgets( p->id1, MAX_READ_ID,  fq ) == NULL ) break;
-			fgets( p->seq1,  MAX_READ_CYCLE, fq );
-			fgets( p->qual1, MAX_READ_CYCLE, fq );	// this line is useless
-			fgets( p->qual1, MAX_READ_CYCLE, fq );
-			p->size = strlen( p->seq1 );
-
-			++ p;
-		}
-	} else {
-		while( p != q ) {
-			if( fgets( p->id2, MAX_READ_ID,  fq ) == NULL ) break;
-			fgets( p->seq2,  MAX_READ_CYCLE, fq );
-			fgets( p->qual2, MAX_READ_CYCLE, fq );	// this line is useless
-			fgets( p->qual2, MAX_READ_CYCLE, fq );
-			p->size2 = strlen( p->seq2 );
-
-			++ p;
+/*
+ * estimated memory usage (in bytes) of trimming with the sizes in kp: the loaded batches, the
+ * output buffers (and their compressed copies) and the input buffers
+ * it is an upper bound for the copied reads, as the reads of mapped files take no space in the batches
+*/
+unsigned long estimate_memory( const ktrim_param &kp ) {
+	register unsigned long nfile = kp.paired_end_data ? 2 : 1;
+	register unsigned long ncopy = kp.gzip_output ? 2 : 1;
+	register unsigned long per_read = (kp.record_size ? kp.record_size : READ_SLOT_SIZE) * nfile +
+										(kp.paired_end_data ? sizeof(CPEREAD) : sizeof(CSEREAD));
+	register unsigned long input = (unsigned long) FQ_BLOCK_SIZE * 2 * nfile;
+	if( kp.thread > 2 ) {	// the decompression jobs of Gzipped input
+		for( unsigned int i=0; i!=kp.R1s.size(); ++i ) {
+			if( kp.R1s[i].size() > 3 && kp.R1s[i].compare( kp.R1s[i].size()-3, 3, ".gz" ) == 0 ) {
+				input += (unsigned long) PGZ_JOB_SIZE * 4 * PGZ_JOBS_PER_THREAD * kp.thread;
+				break;
+			}
 		}
 	}
-	return p - loadingReads;
+
+	if( kp.thread == 1 )
+		return kp.reads_per_batch_st * per_read + 2 * kp.batch_buffer_size_st * nfile * ncopy + input;
+
+	register unsigned long nbatch = ( kp.thread == 2 && kp.paired_end_data ) ? 1 : kp.batches_in_flight;
+	register unsigned long nslot  = kp.thread << 2;
+	return nbatch * kp.reads_per_batch * per_read + nslot * kp.piece_buffer_size * nfile * ncopy + input;
 }
 
-// update in v1.2: support Gzipped input file
-unsigned int load_batch_data_PE_GZ( gzFile gfp, CPEREAD *loadingReads, const unsigned int num, const bool isRead1 ) {
-	//register unsigned int loaded = 0;
-	register CPEREAD *p = loadingReads;
-	register CPEREAD *q = p + num;
-	if( isRead1 ) {
-		while( p != q ) {
-			if( gzgets( gfp, p->id1, MAX_READ_ID  ) == NULL ) break;
-			gzgets( gfp, p->seq1,  MAX_READ_CYCLE );
-			gzgets( gfp, p->qual1, MAX_READ_CYCLE );	// this line is useless
-			gzgets( gfp, p->qual1, MAX_READ_CYCLE );
-			p->size = strlen( p->seq1 );
-
-			++ p;
-		}
-	} else {
-		while( p != q ) {
-			if( gzgets( gfp, p->id2, MAX_READ_ID  ) == NULL ) break;
-			gzgets( gfp, p->seq2,  MAX_READ_CYCLE );
-			gzgets( gfp, p->qual2, MAX_READ_CYCLE );	// this line is useless
-			gzgets( gfp, p->qual2, MAX_READ_CYCLE );
-			p->size2 = strlen( p->seq2 );
-
-			++ p;
+/*
+ * update in v1.7: size the batches and buffers at runtime instead of the compile-time constants
+ * the output buffers and the arenas of the batches are sized by the records in the first reads of the
+ * input (they still grow for longer records); with '--max-memory', the batches are halved (down to 1 piece) and then fewer
+ * batches are kept in flight until the estimated memory usage fits
+ * the batches always hold a multiple of READS_PER_PIECE reads, so the output does not change
+*/
+void tune_memory( ktrim_param &kp ) {
+	kp.reads_per_batch      = READS_PER_BATCH;
+	kp.reads_per_batch_st   = READS_PER_BATCH_ST;
+	kp.batches_in_flight    = BATCHES_IN_FLIGHT + ( kp.use_mmap ? (kp.thread >> 2) : 0 );	// see fq_split.h
+	kp.piece_buffer_size    = BUFFER_SIZE_PER_PIECE;
+	kp.batch_buffer_size_st = BUFFER_SIZE_PER_BATCH_READ_ST;
+
+	register unsigned int rec = kp.R1s.empty() ? 0 : sample_record_size( kp.R1s[0] );
+	if( kp.paired_end_data && ! kp.R2s.empty() ) {
+		register unsigned int rec2 = sample_record_size( kp.R2s[0] );
+		if( rec2 > rec )
+			rec = rec2;
+	}
+	kp.record_size = rec;
+	if( rec != 0 ) {
+		kp.piece_buffer_size    = READS_PER_PIECE * rec;
+		kp.batch_buffer_size_st = READS_PER_BATCH_ST * rec;
+	}
+
+	if( kp.max_memory == 0 )
+		return;
+	while( estimate_memory( kp ) > kp.max_memory ) {
+		if( kp.thread == 1 && kp.reads_per_batch_st > READS_PER_PIECE ) {
+			kp.reads_per_batch_st   >>= 1;
+			kp.batch_buffer_size_st >>= 1;
+		} else if( kp.thread != 1 && kp.reads_per_batch > READS_PER_PIECE ) {
+			kp.reads_per_batch >>= 1;
+		} else if( kp.thread > 2 && kp.batches_in_flight > MIN_BATCHES_IN_FLIGHT ) {
+			-- kp.batches_in_flight;
+		} else {
+			cerr << "\033[1;32mWarning: '--max-memory' is too small! About " << (estimate_memory(kp) >> 20)
+				 << " MB is needed with '-t " << kp.thread << "'.\033[0m\n";
+			break;
 		}
 	}
-	return p - loadingReads;
 }
 
-unsigned int load_batch_data_PE_both_C( FILE *fq1, FILE *fq2, CPEREAD *loadingReads, unsigned int num ) {
-	//register unsigned int loaded = 0;
-	register CPEREAD *p = loadingReads;
-	register CPEREAD *q = p + num;
-	register CPEREAD *s = p;
-	// load read1
-	while( p != q ) {
-		if( fgets( p->id1, MAX_READ_ID,  fq1 ) == NULL ) break;
-		fgets( p->seq1,  MAX_READ_CYCLE, fq1 );
-		fgets( p->qual1, MAX_READ_CYCLE, fq1 );	// this line is useless
-		fgets( p->qual1, MAX_READ_CYCLE, fq1 );
-		p->size = strlen( p->seq1 );
+/*
+ * update in v1.7: a batch of loaded reads is trimmed in pieces of READS_PER_PIECE reads, which are
+ * taken by the working threads dynamically; READS_PER_PIECE is a multiple of GZ_MEMBER_READS,
+ * therefore the gzip members in the output (see gz_writer.h) do not depend on the number of threads
+*/
+unsigned int inline batch_npiece( unsigned int loaded ) {
+	return (loaded + READS_PER_PIECE - 1) / READS_PER_PIECE;
+}
 
-		++ p;
+// the first read of a piece
+unsigned int inline piece_start( unsigned int loaded, unsigned int piece ) {
+	register unsigned int start = piece * READS_PER_PIECE;
+	return start < loaded ? start : loaded;
+}
+
+/*
+ * update in v1.7: write a FASTQ record into the write buffer using the known lengths, which is much
+ * faster than sprintf; the id contains the tailing '\n', and seq/qual are trimmed to size
+ * the buffer is enlarged if there is not enough space
+*/
+void inline emit_fastq_record( char * &buffer, unsigned int &stored, unsigned int &capacity,
+								const char *id, unsigned int id_len, const char *seq, const char *qual, unsigned int size ) {
+	register unsigned int need = id_len + (size << 1) + 4;
+	if( stored + need > capacity ) {
+		register unsigned int newcap = capacity << 1;
+		if( newcap < stored + need )
+			newcap = stored + need;
+		char *p = new char[ newcap ];
+		memcpy( p, buffer, stored );
+		delete [] buffer;
+		buffer = p;
+		capacity = newcap;
 	}
 
-	// load read2
-	while( s != p ) {
-		fgets( s->id2,   MAX_READ_ID,    fq2 );
-		fgets( s->seq2,  MAX_READ_CYCLE, fq2 );
-		fgets( s->qual2, MAX_READ_CYCLE, fq2 );	// this line is useless
-		fgets( s->qual2, MAX_READ_CYCLE, fq2 );
-		s->size2 = strlen( s->seq2 );
+	register char *p = buffer + stored;
+	memcpy( p, id, id_len );
+	p += id_len;
+	memcpy( p, seq, size );
+	p += size;
+	p[0] = '\n';
+	p[1] = '+';
+	p[2] = '\n';
+	p += 3;
+	memcpy( p, qual, size );
+	p[size] = '\n';
+	stored += need;
+}
 
-		++ s;
+// update in v1.7: scatter-gather output, no copy of the reads is needed
+const char FASTQ_PLUS_LINE[] = "\n+\n";
+
+void init_iov_wrbuffer( writeBuffer &writebuffer, unsigned int nthread ) {
+	writebuffer.iov1 = new struct iovec * [ nthread ];
+	writebuffer.iov2 = new struct iovec * [ nthread ];
+	writebuffer.iov1n = new unsigned int [ nthread ];
+	writebuffer.iov2n = new unsigned int [ nthread ];
+	writebuffer.iov1capacity = new unsigned int [ nthread ];
+	writebuffer.iov2capacity = new unsigned int [ nthread ];
+	for( unsigned int i=0; i!=nthread; ++i ) {
+		writebuffer.iov1[i] = NULL;
+		writebuffer.iov2[i] = NULL;
+		writebuffer.iov1n[i] = 0;
+		writebuffer.iov2n[i] = 0;
+		writebuffer.iov1capacity[i] = 0;
+		writebuffer.iov2capacity[i] = 0;
 	}
+}
 
-	return p - loadingReads;
+void free_iov_wrbuffer( writeBuffer &writebuffer, unsigned int nthread ) {
+	for( unsigned int i=0; i!=nthread; ++i ) {
+		free( writebuffer.iov1[i] );
+		free( writebuffer.iov2[i] );
+	}
+	delete [] writebuffer.iov1;
+	delete [] writebuffer.iov2;
+	delete [] writebuffer.iov1n;
+	delete [] writebuffer.iov2n;
+	delete [] writebuffer.iov1capacity;
+	delete [] writebuffer.iov2capacity;
 }
 
-// update in v1.2: support Gzipped input file
-unsigned int load_batch_data_PE_both_GZ( gzFile gfp1, gzFile gfp2, CPEREAD *loadingReads, unsigned int num ) {
-	//register unsigned int loaded = 0;
-	register CPEREAD *p = loadingReads;
-	register CPEREAD *q = p + num;
-	register CPEREAD *s = p;
-	while( p != q ) {
-		if( gzgets( gfp1, p->id1, MAX_READ_ID  ) == NULL ) break;
-		gzgets( gfp1, p->seq1,  MAX_READ_CYCLE );
-		gzgets( gfp1, p->qual1, MAX_READ_CYCLE );	// this line is useless
-		gzgets( gfp1, p->qual1, MAX_READ_CYCLE );
-		p->size = strlen( p->seq1 );
+void inline add_iovec( struct iovec *iov, const char *p, unsigned int len ) {
+	iov->iov_base = (void *) p;
+	iov->iov_len  = len;
+}
 
-		++ p;
+/*
+ * the same as emit_fastq_record, but the record is written as a list of pointers to the read
+ * the read must be kept until the iovecs are written
+*/
+void inline emit_fastq_iovec( struct iovec * &iov, unsigned int &n, unsigned int &capacity,
+								const char *id, unsigned int id_len, const char *seq, const char *qual, unsigned int size ) {
+	if( n + 5 > capacity ) {
+		capacity = capacity ? capacity<<1 : (1<<12);
+		iov = (struct iovec *) realloc( iov, capacity * sizeof(struct iovec) );
 	}
-	while( s != p ) {
-		gzgets( gfp2, s->id2,   MAX_READ_ID    );
-		gzgets( gfp2, s->seq2,  MAX_READ_CYCLE );
-		gzgets( gfp2, s->qual2, MAX_READ_CYCLE );	// this line is useless
-		gzgets( gfp2, s->qual2, MAX_READ_CYCLE );
-		s->size2 = strlen( s->seq2 );
-
-		++ s;
+	register struct iovec *v = iov + n;
+	add_iovec( v,   id, id_len );
+	add_iovec( v+1, seq, size );
+	add_iovec( v+2, FASTQ_PLUS_LINE, 3 );
+	add_iovec( v+3, qual, size );
+	add_iovec( v+4, FASTQ_PLUS_LINE, 1 );	// '\n'
+	n += 5;
+}
+
+/*
+ * write all the iovecs to fd; writev() accepts IOV_MAX iovecs per call and may write partially
+ * returns false if the write fails (the error is reported by the caller)
+*/
+bool writev_all( int fd, struct iovec *iov, unsigned int n ) {
+	while( n ) {
+		ssize_t written = writev( fd, iov, n < IOV_MAX ? n : IOV_MAX );
+		if( written < 0 ) {
+			if( errno == EINTR )
+				continue;
+			return false;
+		}
+		// skip the iovecs that have been written
+		while( n && (size_t)written >= iov->iov_len ) {
+			written -= iov->iov_len;
+			++ iov;
+			-- n;
+		}
+		if( n ) {
+			iov->iov_base = (char *) iov->iov_base + written;
+			iov->iov_len -= written;
+		}
 	}
+	return true;
+}
 
-	return p - loadingReads;
+// update in v1.7: initial size of the arena for n reads, see tune_memory
+size_t inline arena_size( const ktrim_param &kp, unsigned int n ) {
+	return (size_t) n * ( kp.record_size ? kp.record_size : READ_SLOT_SIZE );
+}
+
+void arena_init( READ_ARENA *arena, size_t capacity ) {
+	arena->data = capacity ? new char[ capacity ] : NULL;
+	arena->size = 0;
+	arena->capacity = capacity;
+}
+
+void arena_free( READ_ARENA *arena ) {
+	delete [] arena->data;
 }
 
 /*
- * use dynamic max_mismatch as the covered size can range from 3 to a large number such as 50,
- * here the maximum mismatch allowed is LEN/8
+ * make sure that size more bytes could be stored in the arena
+ * if it has to be moved, the old data is returned (NULL otherwise), and the caller should rebase the
+ * reads pointing into it (see rebase_reads_SE/PE) and then delete it
 */
-bool check_mismatch_dynamic_SE_C( CSEREAD *read, unsigned int pos, const ktrim_param & kp ) {
-	register unsigned int mis=0;
-	register unsigned int i, len;
-	len = read->size - pos;
-	if( len > kp.adapter_len )
-		len = kp.adapter_len;
-
-	register unsigned int max_mismatch_dynamic;
-	// update in v1.1.0: allows the users to set the proportion of mismatches
-	if( kp.use_default_mismatch ) {
-		max_mismatch_dynamic = len >> 3;
-		if( (max_mismatch_dynamic<<3) != len )
-			++ max_mismatch_dynamic;
-	} else {
-		max_mismatch_dynamic = ceil( len * kp.mismatch_rate );
-	}
+char * arena_reserve( READ_ARENA *arena, size_t size ) {
+	if( arena->size + size <= arena->capacity )
+		return NULL;
+
+	register size_t capacity = arena->capacity << 1;
+	if( capacity < arena->size + size )
+		capacity = arena->size + size;
+	register char *old = arena->data;
+	arena->data = new char[ capacity ];
+	memcpy( arena->data, old, arena->size );
+	arena->capacity = capacity;
+	return old;
+}
 
-	register const char *p = read->seq;
-	for( i=0; i!=len; ++i ) {
-		if( p[pos+i] != kp.adapter_r1[i] ) {
-			if( mis == max_mismatch_dynamic )
-			  return false;
+void inline rebase( char * &p, const char *old, char *data ) {
+	p = data + (p - old);
+}
+
+void rebase_reads_SE( CSEREAD *p, CSEREAD *q, const char *old, char *data ) {
+	for( ; p != q; ++p ) {
+		rebase( p->id,   old, data );
+		rebase( p->seq,  old, data );
+		rebase( p->qual, old, data );
+	}
+}
 
-			++ mis;
+void rebase_reads_PE( CPEREAD *p, CPEREAD *q, const char *old, char *data, bool isRead1 ) {
+	for( ; p != q; ++p ) {
+		if( isRead1 ) {
+			rebase( p->id1,   old, data );
+			rebase( p->seq1,  old, data );
+			rebase( p->qual1, old, data );
+		} else {
+			rebase( p->id2,   old, data );
+			rebase( p->seq2,  old, data );
+			rebase( p->qual2, old, data );
 		}
 	}
+}
 
-	return true;
+// bytes of the record in the arena
+unsigned int inline record_bytes( const FQ_RECORD *rec ) {
+	register unsigned int n = rec->seq_len;
+	if( rec->qual_len < n )
+		n = rec->qual_len;
+	return rec->id_len + (n << 1);
 }
 
 /*
- * use dynamic max_mismatch as the covered size can range from 3 to a large number such as 50,
- * here the maximum mismatch allowed is LEN/4 for read1 + read2
+ * fill a read with a record from the block reader
+ * for memory-mapped files the read points into the file directly (zero-copy); otherwise the record
+ * is appended to the arena (which must have room for it, see record_bytes)
+ * update in v1.7: the reads are no longer truncated to MAX_READ_ID/MAX_READ_CYCLE, i.e., reads and ids
+ * of any length are kept as they are
+ * the id keeps its tailing '\n' while seq/qual do not; returns the length of the sequence
 */
-bool check_mismatch_dynamic_PE_C( const CPEREAD *read, unsigned int pos, const ktrim_param &kp ) {
-	register unsigned int mis1=0, mis2=0;
-	register unsigned int i, len;
-	len = read->size - pos;
-	if( len > kp.adapter_len )
-		len = kp.adapter_len;
-
-	register unsigned int max_mismatch_dynamic;
-	// update in v1.1.0: allows the users to set the proportion of mismatches
-	// BUT it is highly discouraged
-	if( kp.use_default_mismatch ) {
-		// each read allows 1/8 mismatches of the total comparable length
-		max_mismatch_dynamic = len >> 3;
-		if( (max_mismatch_dynamic<<3) != len )
-			++ max_mismatch_dynamic;
-	} else {
-		max_mismatch_dynamic = ceil( len * kp.mismatch_rate );
+unsigned int inline fill_read( const FQ_READER *fr, const FQ_RECORD *rec, READ_ARENA *arena,
+								char * &id, unsigned int &id_len, char * &seq, char * &qual ) {
+	register unsigned int n = rec->seq_len;
+	if( rec->qual_len < n )
+		n = rec->qual_len;
+
+	if( fr->type == FQ_MMAP ) {
+		id     = rec->id;
+		id_len = rec->id_len;
+		seq    = rec->seq;
+		qual   = rec->qual;
+		return n;
 	}
 
-	// check mismatch for each read
-	register const char * p = read->seq1 + pos;
-	register const char * q = kp.adapter_r1;
-	for( i=0; i!=len; ++i, ++p, ++q ) {
-		if( *p != *q ) {
-			if( mis1 == max_mismatch_dynamic )
-				return false;
+	id_len = rec->id_len;
+	id   = arena->data + arena->size;
+	seq  = id  + id_len;
+	qual = seq + n;
+	arena->size += id_len + (n << 1);
 
-			++ mis1;
-		}
-	}
-	p = read->seq2 + pos;
-	q = kp.adapter_r2;
-	for( i=0; i!=len; ++i, ++p, ++q ) {
-		if( *p != *q ) {
-			if( mis2 == max_mismatch_dynamic )
-				return false;
-
-			++ mis2;
-		}
-	}
+	memcpy( id,   rec->id,   id_len );
+	memcpy( seq,  rec->seq,  n );
+	memcpy( qual, rec->qual, n );
 
-	return true;
+	return n;
 }
 
-// update in v1.2: support window check
-int get_quality_trim_cycle_se( const char *p, const int total_size, const ktrim_param &kp ) {
-	register int i, j, k;
-	register int stop = kp.min_length-1;
-	for( i=total_size-1; i>=stop; ) {
-		if( p[i] >= kp.quality ) {
-			k = i - kp.window;
-			for( j=i-1; j!=k; --j ) {
-				if( j<0 || p[j]<kp.quality ) {
-					break;
-				}
+// update in v1.7: use the block-based reader instead of 4 fgets calls per read
+// Gzipped files are also handled by the block-based reader, see fq_reader.h
+unsigned int load_batch_data_SE_C( FQ_READER *fr, CSEREAD *loadingReads, READ_ARENA *arena, unsigned int num ) {
+	register CSEREAD *p = loadingReads;
+	register CSEREAD *q = p + num;
+	FQ_RECORD rec;
+	arena->size = 0;
+	while( p != q ) {
+		if( ! fq_reader_next( fr, &rec ) ) break;
+		if( fr->type != FQ_MMAP ) {
+			register char *old = arena_reserve( arena, record_bytes( &rec ) );
+			if( old != NULL ) {
+				rebase_reads_SE( loadingReads, p, old, arena->data );
+				delete [] old;
 			}
-			if( j == k ) { // find the quality trimming position
-				break;
-			} else {	// there is a low-quality base in the middle
-				i = j - 1;
+		}
+		p->size = fill_read( fr, &rec, arena, p->id, p->id_len, p->seq, p->qual );
+
+		++ p;
+	}
+	return p-loadingReads;
+}
+
+// for paired-end data, read1 and read2 are loaded into their own arenas
+unsigned int load_batch_data_PE_C( FQ_READER *fr, CPEREAD *loadingReads, READ_ARENA *arena,
+									const unsigned int num, const bool isRead1 ) {
+	register CPEREAD *p = loadingReads;
+	register CPEREAD *q = p + num;
+	FQ_RECORD rec;
+	arena->size = 0;
+	while( p != q ) {
+		if( ! fq_reader_next( fr, &rec ) ) break;
+		if( fr->type != FQ_MMAP ) {
+			register char *old = arena_reserve( arena, record_bytes( &rec ) );
+			if( old != NULL ) {
+				rebase_reads_PE( loadingReads, p, old, arena->data, isRead1 );
+				delete [] old;
 			}
-		} else {
-			-- i;
 		}
+		if( isRead1 )
+			p->size  = fill_read( fr, &rec, arena, p->id1, p->id1_len, p->seq1, p->qual1 );
+		else
+			p->size2 = fill_read( fr, &rec, arena, p->id2, p->id2_len, p->seq2, p->qual2 );
+
+		++ p;
 	}
+	return p - loadingReads;
+}
 
-	if( i >= stop )
-		return i + 1;
-	else
-		return 0;
+// arena[0] and arena[1] are used for read1 and read2; returns the reads of read1, and those of read2 in loaded2
+unsigned int load_batch_data_PE_both_C( FQ_READER *fr1, FQ_READER *fr2, CPEREAD *loadingReads, READ_ARENA *arena,
+										unsigned int num, unsigned int &loaded2 ) {
+	register unsigned int loaded = load_batch_data_PE_C( fr1, loadingReads, arena, num, true );
+	loaded2 = load_batch_data_PE_C( fr2, loadingReads, arena+1, num, false );
+
+	return loaded;
 }
 
-int get_quality_trim_cycle_pe( const CPEREAD *read, const ktrim_param &kp ) {
-	register int i, j, k;
-	register int stop = kp.min_length - 1;
-	const char *p = read->qual1;
-	const char *q = read->qual2;
-	for( i=read->size-1; i>=stop; ) {
-		if( p[i]>=kp.quality && q[i]>=kp.quality ) {
-			k = i - kp.window;
-			for( j=i-1; j!=k; --j ) {
-				if( j<0 || p[j]<kp.quality || q[j]<kp.quality ) {
-					break;
-				}
-			}
-			if( j == k ) { // find the quality trimming position
-				break;
-			} else {
-				i = j - 1;
-			}
+/*
+ * update in v1.7: the maximum mismatches allowed for each compared length are computed once, instead of
+ * for every seed; the adapters are padded for the vector compares (see count_mismatch in seed_scan.h)
+ * must be called after the adapters are set
+*/
+void init_mismatch( ktrim_param &kp ) {
+	register unsigned int len, max_mismatch_dynamic;
+	for( len=0; len<=MAX_ADAPTER_SIZE; ++len ) {
+		// update in v1.1.0: allows the users to set the proportion of mismatches
+		// BUT it is highly discouraged
+		if( kp.use_default_mismatch ) {
+			// each read allows 1/8 mismatches of the total comparable length
+			max_mismatch_dynamic = len >> 3;
+			if( (max_mismatch_dynamic<<3) != len )
+				++ max_mismatch_dynamic;
 		} else {
-			-- i;
+			max_mismatch_dynamic = ceil( len * kp.mismatch_rate );
 		}
+		// all the seeds are accepted if there could not be more mismatches than that
+		kp.max_mismatch[len] = ( max_mismatch_dynamic > len ) ? len : max_mismatch_dynamic;
 	}
-	
-	if( i >= stop )
-		return i + 1;
-	else
-		return 0;
+
+	memset( kp.adapter_pad1, 0, MAX_ADAPTER_SIZE );
+	memset( kp.adapter_pad2, 0, MAX_ADAPTER_SIZE );
+	memcpy( kp.adapter_pad1, kp.adapter_r1, kp.adapter_len );
+	memcpy( kp.adapter_pad2, kp.adapter_r2, kp.adapter_len );
 }
 
 #endif